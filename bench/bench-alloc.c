@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * malloc/calloc/realloc interposition: the benchmark executable overloads
+ * libc allocator symbols, every library (lua, json-c, libafb) therefore goes
+ * through these wrappers. Counting is per thread and only while enabled.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "bench-utils.h"
+
+#define BENCH_BOOT_SIZE 8192  // static heap used while dlsym resolves real allocator
+
+static void *(*realMalloc) (size_t size);
+static void *(*realCalloc) (size_t count, size_t size);
+static void *(*realRealloc) (void *ptr, size_t size);
+static void (*realFree) (void *ptr);
+
+static char bootHeap[BENCH_BOOT_SIZE] __attribute__((aligned(16)));
+static size_t bootUsed;
+static int resolving;
+
+static __thread int counting;
+static __thread unsigned long allocCount;
+static __thread unsigned long allocBytes;
+
+static void *BenchBootAlloc (size_t size) {
+    size= (size + 15) & ~(size_t)15;
+    if (bootUsed + size > sizeof(bootHeap)) return NULL;
+    void *ptr= &bootHeap[bootUsed];
+    bootUsed += size;
+    return ptr;
+}
+
+static int BenchIsBoot (void *ptr) {
+    return ((char*)ptr >= bootHeap && (char*)ptr < &bootHeap[sizeof(bootHeap)]);
+}
+
+static void BenchResolve (void) {
+    resolving= 1;
+    realMalloc= dlsym (RTLD_NEXT, "malloc");
+    realCalloc= dlsym (RTLD_NEXT, "calloc");
+    realRealloc= dlsym (RTLD_NEXT, "realloc");
+    realFree= dlsym (RTLD_NEXT, "free");
+    resolving= 0;
+    if (!realMalloc || !realCalloc || !realRealloc || !realFree) abort();
+}
+
+static inline void BenchCount (size_t size) {
+    if (counting) {
+        allocCount++;
+        allocBytes += size;
+    }
+}
+
+void *malloc (size_t size) {
+    if (!realMalloc) {
+        if (resolving) return BenchBootAlloc (size);
+        BenchResolve();
+    }
+    BenchCount (size);
+    return realMalloc (size);
+}
+
+void *calloc (size_t count, size_t size) {
+    if (!realCalloc) {
+        if (resolving) return BenchBootAlloc (count * size); // static heap is zeroed
+        BenchResolve();
+    }
+    BenchCount (count * size);
+    return realCalloc (count, size);
+}
+
+void *realloc (void *ptr, size_t size) {
+    if (!realRealloc) BenchResolve();
+
+    if (ptr && BenchIsBoot (ptr)) {
+        size_t avail= (size_t)(&bootHeap[sizeof(bootHeap)] - (char*)ptr);
+        void *copy= malloc (size);
+        if (copy) memcpy (copy, ptr, size < avail ? size : avail);
+        return copy;
+    }
+    BenchCount (size);
+    return realRealloc (ptr, size);
+}
+
+void free (void *ptr) {
+    if (!ptr || BenchIsBoot (ptr)) return;
+    if (!realFree) BenchResolve();
+    realFree (ptr);
+}
+
+void BenchAllocStart (void) {
+    allocCount= 0;
+    allocBytes= 0;
+    counting= 1;
+}
+
+void BenchAllocStop (unsigned long *count, unsigned long *bytes) {
+    counting= 0;
+    *count= allocCount;
+    *bytes= allocBytes;
+}
@@ -0,0 +1,31 @@
+###########################################################################
+# Copyright 2015-2021 IoT.bzh
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+###########################################################################
+
+# run one benchmark with json output then compare it with baseline, strict mode
+# fails when a checked metric has no baseline value
+# cmake -DBENCH=exe -DARGS="..." -DRESULTS=file -DCOMPARE=exe -DBASELINE=file -P bench-check.cmake
+
+separate_arguments(ARGS)
+
+execute_process(COMMAND ${BENCH} ${ARGS} -j ${RESULTS} RESULT_VARIABLE status)
+if(status)
+    message(FATAL_ERROR "${BENCH} failed (${status})")
+endif()
+
+execute_process(COMMAND ${COMPARE} -s ${BASELINE} ${RESULTS} RESULT_VARIABLE status)
+if(status)
+    message(FATAL_ERROR "performance regression against ${BASELINE}")
+endif()
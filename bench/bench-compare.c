@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Compare benchmark json results with a stored baseline. Only metrics having
+ * a tolerance (per benchmark or global) are checked; a metric regresses when
+ * it is worse than baseline by more than its tolerance ratio. Exit status is
+ * non zero on regression. With -u, baseline values are refreshed from results.
+ * With -s (strict, used by ctest), a checked metric without baseline value is
+ * reported as MISSING and fails the comparison instead of being accepted as NEW.
+ *
+ * baseline: {"tolerance":{metric:ratio}, "benchmarks":{name:{metric:value, "tolerance":{metric:ratio}}}}
+ * results:  {"suite":name, "results":[{"name":name, metric:value}]}
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <json-c/json.h>
+
+// metrics where higher is better, any other metric is lower is better
+static const char *higherBetter[]= {"throughput", NULL};
+
+// informative fields never stored in baseline
+static const char *ignored[]= {"name", "iterations", "requests", "errors", NULL};
+
+static int BenchInList (const char *name, const char **list) {
+    for (int idx=0; list[idx]; idx++) if (!strcmp (name, list[idx])) return 1;
+    return 0;
+}
+
+// benchmark tolerance overloads global one, negative when metric is not checked
+static double BenchTolerance (json_object *globalJ, json_object *benchJ, const char *metric) {
+    json_object *tolJ, *valueJ;
+
+    if (benchJ && json_object_object_get_ex (benchJ, "tolerance", &tolJ) && json_object_object_get_ex (tolJ, metric, &valueJ)) {
+        return json_object_get_double (valueJ);
+    }
+    if (globalJ && json_object_object_get_ex (globalJ, metric, &valueJ)) {
+        return json_object_get_double (valueJ);
+    }
+    return -1.0;
+}
+
+static int BenchCompare (json_object *baselineJ, json_object *resultJ, int strict, int *checked) {
+    json_object *nameJ, *globalJ=NULL, *benchsJ, *benchJ=NULL, *baseJ;
+    int regressions=0;
+
+    if (!json_object_object_get_ex (resultJ, "name", &nameJ)) return 0;
+    const char *name= json_object_get_string (nameJ);
+
+    json_object_object_get_ex (baselineJ, "tolerance", &globalJ);
+    if (json_object_object_get_ex (baselineJ, "benchmarks", &benchsJ)) json_object_object_get_ex (benchsJ, name, &benchJ);
+
+    json_object_object_foreach (resultJ, metric, currentJ) {
+        if (BenchInList (metric, ignored)) continue;
+
+        double tolerance= BenchTolerance (globalJ, benchJ, metric);
+        if (tolerance < 0) continue;
+
+        double current= json_object_get_double (currentJ);
+        if (!benchJ || !json_object_object_get_ex (benchJ, metric, &baseJ) || (!json_object_is_type (baseJ, json_type_double) && !json_object_is_type (baseJ, json_type_int))) {
+            printf ("%-32s %-10s %12s %12.1f %8s  %s\n", name, metric, "-", current, "", strict ? "MISSING" : "NEW");
+            regressions += strict;
+            continue;
+        }
+
+        double base= json_object_get_double (baseJ);
+        double delta= base ? (current - base) / base : (current ? 1.0 : 0.0);
+        int higher= BenchInList (metric, higherBetter);
+        int regressed= higher ? (current < base * (1.0 - tolerance)) : (current > base * (1.0 + tolerance));
+
+        printf ("%-32s %-10s %12.1f %12.1f %+7.1f%%  %s\n", name, metric, base, current, delta * 100.0, regressed ? "REGRESSION" : "ok");
+        regressions += regressed;
+        (*checked)++;
+    }
+    return regressions;
+}
+
+// store result metrics into baseline, existing tolerances are kept
+static void BenchUpdate (json_object *baselineJ, json_object *resultJ) {
+    json_object *nameJ, *benchsJ, *benchJ;
+
+    if (!json_object_object_get_ex (resultJ, "name", &nameJ)) return;
+    const char *name= json_object_get_string (nameJ);
+
+    if (!json_object_object_get_ex (baselineJ, "benchmarks", &benchsJ)) {
+        benchsJ= json_object_new_object();
+        json_object_object_add (baselineJ, "benchmarks", benchsJ);
+    }
+    if (!json_object_object_get_ex (benchsJ, name, &benchJ)) {
+        benchJ= json_object_new_object();
+        json_object_object_add (benchsJ, name, benchJ);
+    }
+
+    json_object_object_foreach (resultJ, metric, valueJ) {
+        if (BenchInList (metric, ignored)) continue;
+        json_object_object_add (benchJ, metric, json_object_new_double (json_object_get_double (valueJ)));
+    }
+}
+
+int main (int argc, char *argv[]) {
+    json_object *baselineJ, *resultsJ;
+    int option, update=0, strict=0, regressions=0, checked=0;
+
+    while ((option= getopt (argc, argv, "ush")) != -1) {
+        switch (option) {
+            case 'u':
+                update= 1;
+                break;
+            case 's':
+                strict= 1;
+                break;
+            default:
+                goto OnUsageExit;
+        }
+    }
+    if (argc - optind < 2) goto OnUsageExit;
+
+    const char *baselinePath= argv[optind];
+    baselineJ= json_object_from_file (baselinePath);
+    if (!baselineJ) {
+        fprintf (stderr, "bench-compare: invalid baseline %s\n", baselinePath);
+        return 2;
+    }
+
+    printf ("%-32s %-10s %12s %12s %8s\n", "benchmark", "metric", "baseline", "current", "delta");
+    for (int idx= optind+1; idx < argc; idx++) {
+        json_object *listJ;
+
+        resultsJ= json_object_from_file (argv[idx]);
+        if (!resultsJ || !json_object_object_get_ex (resultsJ, "results", &listJ) || !json_object_is_type (listJ, json_type_array)) {
+            fprintf (stderr, "bench-compare: invalid results %s\n", argv[idx]);
+            return 2;
+        }
+
+        for (size_t jdx=0; jdx < json_object_array_length (listJ); jdx++) {
+            json_object *resultJ= json_object_array_get_idx (listJ, jdx);
+            if (update) BenchUpdate (baselineJ, resultJ);
+            else regressions += BenchCompare (baselineJ, resultJ, strict, &checked);
+        }
+        json_object_put (resultsJ);
+    }
+
+    if (update) {
+        if (json_object_to_file_ext (baselinePath, baselineJ, JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_SPACED)) {
+            fprintf (stderr, "bench-compare: fail to write %s\n", baselinePath);
+            return 2;
+        }
+        printf ("baseline %s updated\n", baselinePath);
+    } else {
+        printf ("%d metric(s) checked, %d regression(s)\n", checked, regressions);
+    }
+
+    json_object_put (baselineJ);
+    return regressions ? 1 : 0;
+
+OnUsageExit:
+    fprintf (stderr, "usage: %s [-u|-s] baseline.json results.json...\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Loopback load generator driver: embeds lua, preloads afb-luaglue, passes
+ * command line options to load-api.lua (LOAD table) with a monotonic clock
+ * and prints throughput and latency percentiles. Everything runs within one
+ * process, requests go through the real GlueApiVerbCb/marshal/reply path.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "bench-lua.h"
+
+#ifndef BENCH_LOAD_SCRIPT
+#define BENCH_LOAD_SCRIPT "load-api.lua"
+#endif
+
+static void LoadUsage (const char *name) {
+    fprintf (stderr, "usage: %s [-m async|sync] [-c concurrency] [-p payload-bytes] [-d seconds] [-v echo|ping] [-a api] [-u uri] [-s script] [-j results.json]\n", name);
+}
+
+int main (int argc, char *argv[]) {
+    const char *script= BENCH_LOAD_SCRIPT;
+    const char *mode= "async", *verb= "echo", *api= "load", *uri= NULL, *jsonPath= NULL;
+    long concurrency= 8, payload= 64, duration= 5;
+    lua_State *luaState;
+    int option;
+
+    while ((option= getopt (argc, argv, "m:c:p:d:v:a:u:s:j:h")) != -1) {
+        switch (option) {
+            case 'm': mode= optarg; break;
+            case 'c': concurrency= strtol (optarg, NULL, 10); break;
+            case 'p': payload= strtol (optarg, NULL, 10); break;
+            case 'd': duration= strtol (optarg, NULL, 10); break;
+            case 'v': verb= optarg; break;
+            case 'a': api= optarg; break;
+            case 'u': uri= optarg; break;
+            case 's': script= optarg; break;
+            case 'j': jsonPath= optarg; break;
+            default:
+                goto OnUsageExit;
+        }
+    }
+    if (concurrency <= 0 || payload < 0 || duration <= 0) goto OnUsageExit;
+    if (strcmp (mode, "async") && strcmp (mode, "sync")) goto OnUsageExit;
+
+    luaState= BenchLuaNew();
+    if (!luaState) return 1;
+
+    lua_newtable (luaState);
+    lua_pushstring (luaState, mode);
+    lua_setfield (luaState, -2, "mode");
+    lua_pushinteger (luaState, concurrency);
+    lua_setfield (luaState, -2, "concurrency");
+    lua_pushinteger (luaState, payload);
+    lua_setfield (luaState, -2, "payload");
+    lua_pushinteger (luaState, duration);
+    lua_setfield (luaState, -2, "duration");
+    lua_pushstring (luaState, verb);
+    lua_setfield (luaState, -2, "verb");
+    lua_pushstring (luaState, api);
+    lua_setfield (luaState, -2, "api");
+    if (uri) {
+        lua_pushstring (luaState, uri);
+        lua_setfield (luaState, -2, "uri");
+    }
+    lua_setglobal (luaState, "LOAD");
+
+    if (luaL_dofile (luaState, script)) {
+        fprintf (stderr, "bench-load: %s\n", lua_tostring (luaState, -1));
+        goto OnErrorExit;
+    }
+
+    lua_getglobal (luaState, "LOAD");
+    lua_getfield (luaState, -1, "result");
+    if (!lua_istable (luaState, -1)) {
+        fprintf (stderr, "bench-load: no result from %s\n", script);
+        goto OnErrorExit;
+    }
+
+    printf ("mode=%s verb=%s concurrency=%ld payload=%ldB duration=%lds%s%s\n", mode, verb, concurrency, payload, duration, uri ? " uri=" : "", uri ? uri : "");
+    printf ("requests=%.0f errors=%.0f elapsed=%.2fs throughput=%.0f req/s\n"
+        , BenchLuaNumber (luaState, "requests"), BenchLuaNumber (luaState, "errors")
+        , BenchLuaNumber (luaState, "elapsed"), BenchLuaNumber (luaState, "throughput"));
+    printf ("latency(us) mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n"
+        , BenchLuaNumber (luaState, "mean"), BenchLuaNumber (luaState, "p50"), BenchLuaNumber (luaState, "p90")
+        , BenchLuaNumber (luaState, "p99"), BenchLuaNumber (luaState, "p999"), BenchLuaNumber (luaState, "max"));
+
+    if (jsonPath) {
+        FILE *json= fopen (jsonPath, "w");
+        if (!json) {
+            fprintf (stderr, "bench-load: fail to create %s\n", jsonPath);
+            goto OnErrorExit;
+        }
+        // same layout as other benchmarks, name carries the load profile
+        fprintf (json, "{\"suite\":\"load\",\"results\":[\n {\"name\":\"load/%s/%s/c%ld/p%ld\",\"requests\":%.0f,\"errors\":%.0f"
+            ",\"throughput\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}\n]}\n"
+            , mode, verb, mode[0] == 's' ? 1L : concurrency, payload
+            , BenchLuaNumber (luaState, "requests"), BenchLuaNumber (luaState, "errors"), BenchLuaNumber (luaState, "throughput")
+            , BenchLuaNumber (luaState, "mean"), BenchLuaNumber (luaState, "p50"), BenchLuaNumber (luaState, "p90")
+            , BenchLuaNumber (luaState, "p99"), BenchLuaNumber (luaState, "p999"), BenchLuaNumber (luaState, "max"));
+        fclose (json);
+    }
+
+    int status= BenchLuaNumber (luaState, "errors") ? 1 : 0;
+    lua_close (luaState);
+    return status;
+
+OnErrorExit:
+    lua_close (luaState);
+    return 1;
+
+OnUsageExit:
+    LoadUsage (argv[0]);
+    return 1;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Shared setup for lua driven benchmarks: lua state with afb-luaglue
+ * preloaded (no LUA_CPATH required) and a BenchNow() monotonic clock in ns.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+
+#include "bench-lua.h"
+
+int luaopen_luaglue (lua_State *luaState);
+
+static int BenchNow (lua_State *luaState) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    lua_pushinteger (luaState, (lua_Integer)now.tv_sec * 1000000000 + now.tv_nsec);
+    return 1;
+}
+
+lua_State *BenchLuaNew (void) {
+    lua_State *luaState= luaL_newstate();
+    if (!luaState) return NULL;
+
+    luaL_openlibs (luaState);
+    luaL_requiref (luaState, "afb-luaglue", luaopen_luaglue, 0);
+    lua_pop (luaState, 1);
+    lua_register (luaState, "BenchNow", BenchNow);
+    return luaState;
+}
+
+// numeric field from table on top of stack
+double BenchLuaNumber (lua_State *luaState, const char *key) {
+    lua_getfield (luaState, -1, key);
+    double value= lua_tonumber (luaState, -1);
+    lua_pop (luaState, 1);
+    return value;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Lua<->afb marshalling microbenchmarks: LuaTableToJson, LuaPopOneArg,
+ * LuaPushOneArg and LuaPushAfbReply over representative payloads. Runs
+ * in-process on a private lua state, no binder nor network required.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "bench-utils.h"
+
+#define BENCH_DEEP_LEVEL 32      // nested objects
+#define BENCH_ARRAY_SIZE 1024    // numeric array length
+#define BENCH_STRING_SIZE 65536  // long string length
+
+typedef struct {
+    const char *name;
+    json_object *(*build) (void);
+} BenchPayloadT;
+
+typedef struct {
+    lua_State *luaState;
+    json_object *valueJ;
+    const char *text;        // valueJ as json text
+    size_t length;
+    afb_data_t data;         // valueJ as json-c afb data
+    int index;               // valueJ as lua table on stack
+} BenchCtxT;
+
+static json_object *PayloadFlat (void) {
+    json_object *valueJ;
+    wrap_json_pack (&valueJ, "{ss si sf sb ss si sf sb ss si sf sb ss si sf ss}"
+        ,"uid", "sensor-01", "count", 42, "ratio", 0.75, "enabled", 1
+        ,"unit", "celsius", "min", -40, "max", 125.5, "alarm", 0
+        ,"location", "engine-room", "samples", 1024, "average", 21.3, "calibrated", 1
+        ,"vendor", "iot.bzh", "period", 250, "drift", 0.002, "status", "ok"
+    );
+    return valueJ;
+}
+
+static json_object *PayloadDeep (void) {
+    json_object *valueJ= json_object_new_object();
+    json_object_object_add (valueJ, "leaf", json_object_new_string ("bottom"));
+
+    for (int level=BENCH_DEEP_LEVEL; level > 0; level--) {
+        json_object *nodeJ;
+        wrap_json_pack (&nodeJ, "{si ss so}", "level", level, "name", "node", "child", valueJ);
+        valueJ= nodeJ;
+    }
+    return valueJ;
+}
+
+static json_object *PayloadArray (void) {
+    json_object *valueJ= json_object_new_array();
+    for (int idx=0; idx < BENCH_ARRAY_SIZE; idx++) {
+        if (idx % 2) json_object_array_add (valueJ, json_object_new_double (idx * 0.5));
+        else json_object_array_add (valueJ, json_object_new_int (idx));
+    }
+    return valueJ;
+}
+
+static json_object *PayloadString (void) {
+    char *blob= malloc (BENCH_STRING_SIZE +1);
+    for (int idx=0; idx < BENCH_STRING_SIZE; idx++) blob[idx]= (char)('a' + idx % 26);
+    blob[BENCH_STRING_SIZE]= '\0';
+
+    json_object *valueJ;
+    wrap_json_pack (&valueJ, "{ss si}", "blob", blob, "length", BENCH_STRING_SIZE);
+    free (blob);
+    return valueJ;
+}
+
+static const BenchPayloadT payloads[]= {
+    {"flat", PayloadFlat},
+    {"deep", PayloadDeep},
+    {"array", PayloadArray},
+    {"string", PayloadString},
+    {NULL}
+};
+
+// json -> lua values
+static void BenchPushOneArg (void *context) {
+    BenchCtxT *ctx= (BenchCtxT*)context;
+    LuaPushOneArg (ctx->luaState, ctx->valueJ);
+    lua_settop (ctx->luaState, ctx->index);
+}
+
+// lua table -> json
+static void BenchTableToJson (void *context) {
+    BenchCtxT *ctx= (BenchCtxT*)context;
+    json_object *valueJ= LuaTableToJson (ctx->luaState, ctx->index);
+    json_object_put (valueJ);
+}
+
+// lua argument -> json (verb reply/subcall argument path)
+static void BenchPopOneArg (void *context) {
+    BenchCtxT *ctx= (BenchCtxT*)context;
+    json_object *valueJ= LuaPopOneArg (ctx->luaState, ctx->index);
+    json_object_put (valueJ);
+}
+
+// subcall reply as json-c data
+static void BenchReplyJsonC (void *context) {
+    BenchCtxT *ctx= (BenchCtxT*)context;
+    int count;
+    LuaPushAfbReply (ctx->luaState, 1, &ctx->data, &count);
+    lua_settop (ctx->luaState, ctx->index);
+}
+
+// subcall reply as json text (remote api), a new data per reply as on the wire
+static void BenchReplyJson (void *context) {
+    BenchCtxT *ctx= (BenchCtxT*)context;
+    afb_data_t data;
+    int count;
+
+    afb_create_data_raw (&data, AFB_PREDEFINED_TYPE_JSON, ctx->text, ctx->length +1, NULL, NULL);
+    LuaPushAfbReply (ctx->luaState, 1, &data, &count);
+    afb_data_unref (data);
+    lua_settop (ctx->luaState, ctx->index);
+}
+
+static const struct {
+    const char *name;
+    BenchFuncT func;
+} benchs[]= {
+    {"pushonearg", BenchPushOneArg},
+    {"tabletojson", BenchTableToJson},
+    {"poponearg", BenchPopOneArg},
+    {"reply-jsonc", BenchReplyJsonC},
+    {"reply-json", BenchReplyJson},
+    {NULL}
+};
+
+int main (int argc, char *argv[]) {
+    BenchOptsT opts;
+    BenchResultT result;
+    char name[64];
+
+    if (BenchParseArgs (&opts, argc, argv)) return 1;
+    if (BenchJsonOpen (&opts, "marshal")) return 1;
+
+    lua_State *luaState= luaL_newstate();
+    luaL_openlibs (luaState);
+
+    printf ("%-28s %10s %18s %20s %17s\n", "benchmark", "iterations", "time", "allocs", "bytes");
+    for (int pdx=0; payloads[pdx].name; pdx++) {
+        BenchCtxT ctx;
+
+        ctx.luaState= luaState;
+        ctx.valueJ= payloads[pdx].build();
+        ctx.text= json_object_to_json_string_length (ctx.valueJ, JSON_C_TO_STRING_PLAIN, &ctx.length);
+        afb_create_data_raw (&ctx.data, AFB_PREDEFINED_TYPE_JSON_C, json_object_get (ctx.valueJ), 0, (void*)json_object_put, ctx.valueJ);
+        LuaPushOneArg (luaState, ctx.valueJ);
+        ctx.index= lua_gettop (luaState);
+
+        for (int bdx=0; benchs[bdx].name; bdx++) {
+            snprintf (name, sizeof(name), "%s/%s", benchs[bdx].name, payloads[pdx].name);
+            lua_gc (luaState, LUA_GCCOLLECT, 0);
+            BenchRun (&opts, name, benchs[bdx].func, &ctx, &result);
+        }
+
+        lua_settop (luaState, 0);
+        afb_data_unref (ctx.data);
+        json_object_put (ctx.valueJ);
+    }
+
+    lua_close (luaState);
+    BenchJsonClose (&opts);
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Captured traffic replay driver: loads a capture file (json lines written by
+ * capturestart), hands records to replay-api.lua and prints
+ * latency per api/verb next to the latency seen at capture time.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <json-c/json.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "bench-lua.h"
+
+#ifndef BENCH_REPLAY_SCRIPT
+#define BENCH_REPLAY_SCRIPT "replay-api.lua"
+#endif
+
+static void ReplayUsage (const char *name) {
+    fprintf (stderr, "usage: %s -f capture.jsonl (-s api-script | -u uri -a api) [-x speed(0=max)] [-c concurrency] [-t timeout] [-j results.json]\n", name);
+}
+
+// push capture records as lua array, returns record count or -1
+static int ReplayLoad (lua_State *luaState, const char *path) {
+    char *line=NULL;
+    size_t size=0;
+    int count=0;
+
+    FILE *file= fopen (path, "r");
+    if (!file) goto OnErrorExit;
+
+    lua_newtable (luaState);
+    while (getline (&line, &size, file) > 0) {
+        json_object *recordJ= json_tokener_parse (line);
+        if (!recordJ) continue; // truncated last line when capture was still running
+        LuaPushOneArg (luaState, recordJ);
+        lua_rawseti (luaState, -2, ++count);
+        json_object_put (recordJ);
+    }
+    free (line);
+    fclose (file);
+    return count;
+
+OnErrorExit:
+    fprintf (stderr, "bench-replay: fail to open %s\n", path);
+    return -1;
+}
+
+int main (int argc, char *argv[]) {
+    const char *capture= NULL, *script= NULL, *uri= NULL, *api= NULL, *jsonPath= NULL;
+    double speed= 1.0;
+    long concurrency= 64, timeout= 0;
+    lua_State *luaState;
+    int option;
+
+    while ((option= getopt (argc, argv, "f:s:u:a:x:c:t:j:h")) != -1) {
+        switch (option) {
+            case 'f': capture= optarg; break;
+            case 's': script= optarg; break;
+            case 'u': uri= optarg; break;
+            case 'a': api= optarg; break;
+            case 'x': speed= strtod (optarg, NULL); break;
+            case 'c': concurrency= strtol (optarg, NULL, 10); break;
+            case 't': timeout= strtol (optarg, NULL, 10); break;
+            case 'j': jsonPath= optarg; break;
+            default:
+                goto OnUsageExit;
+        }
+    }
+    if (!capture || speed < 0 || concurrency <= 0 || timeout < 0) goto OnUsageExit;
+    if (!script && !(uri && api)) goto OnUsageExit;
+
+    luaState= BenchLuaNew();
+    if (!luaState) return 1;
+
+    lua_newtable (luaState);
+    if (ReplayLoad (luaState, capture) < 0) goto OnErrorExit;
+    lua_setfield (luaState, -2, "records");
+    lua_pushnumber (luaState, speed);
+    lua_setfield (luaState, -2, "speed");
+    lua_pushinteger (luaState, concurrency);
+    lua_setfield (luaState, -2, "concurrency");
+    if (timeout) {
+        lua_pushinteger (luaState, timeout);
+        lua_setfield (luaState, -2, "timeout");
+    }
+    if (script) {
+        lua_pushstring (luaState, script);
+        lua_setfield (luaState, -2, "script");
+    } else {
+        lua_pushstring (luaState, uri);
+        lua_setfield (luaState, -2, "uri");
+        lua_pushstring (luaState, api);
+        lua_setfield (luaState, -2, "api");
+    }
+    lua_setglobal (luaState, "REPLAY");
+
+    if (luaL_dofile (luaState, BENCH_REPLAY_SCRIPT)) {
+        fprintf (stderr, "bench-replay: %s\n", lua_tostring (luaState, -1));
+        goto OnErrorExit;
+    }
+
+    lua_getglobal (luaState, "REPLAY");
+    lua_getfield (luaState, -1, "result");
+    if (!lua_istable (luaState, -1)) {
+        fprintf (stderr, "bench-replay: no result\n");
+        goto OnErrorExit;
+    }
+
+    printf ("records=%.0f completed=%.0f lost=%.0f mismatch=%.0f elapsed=%.2fs throughput=%.0f req/s speed=%s\n"
+        , BenchLuaNumber (luaState, "records"), BenchLuaNumber (luaState, "completed"), BenchLuaNumber (luaState, "lost")
+        , BenchLuaNumber (luaState, "mismatch"), BenchLuaNumber (luaState, "elapsed"), BenchLuaNumber (luaState, "throughput")
+        , speed > 0 ? "paced" : "max");
+    printf ("latency(us) mean=%.1f p50=%.1f p99=%.1f max=%.1f\n"
+        , BenchLuaNumber (luaState, "mean"), BenchLuaNumber (luaState, "p50"), BenchLuaNumber (luaState, "p99"), BenchLuaNumber (luaState, "max"));
+
+    FILE *json= NULL;
+    if (jsonPath) {
+        json= fopen (jsonPath, "w");
+        if (!json) {
+            fprintf (stderr, "bench-replay: fail to create %s\n", jsonPath);
+            goto OnErrorExit;
+        }
+        fprintf (json, "{\"suite\":\"replay\",\"results\":[");
+    }
+
+    printf ("%-40s %8s %10s %10s %10s %10s %12s\n", "api/verb", "count", "mean", "p50", "p99", "max", "captured");
+    lua_getfield (luaState, -1, "verbs");
+    for (int idx=1; lua_rawgeti (luaState, -1, idx) == LUA_TTABLE; idx++) {
+        lua_getfield (luaState, -1, "name");
+        const char *name= lua_tostring (luaState, -1);
+        lua_pop (luaState, 1);
+
+        printf ("%-40s %8.0f %10.1f %10.1f %10.1f %10.1f %12.1f\n", name
+            , BenchLuaNumber (luaState, "count"), BenchLuaNumber (luaState, "mean"), BenchLuaNumber (luaState, "p50")
+            , BenchLuaNumber (luaState, "p99"), BenchLuaNumber (luaState, "max"), BenchLuaNumber (luaState, "captured"));
+        if (json) {
+            fprintf (json, "%s\n {\"name\":\"replay/%s\",\"requests\":%.0f,\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}"
+                , idx > 1 ? "," : "", name, BenchLuaNumber (luaState, "count"), BenchLuaNumber (luaState, "mean")
+                , BenchLuaNumber (luaState, "p50"), BenchLuaNumber (luaState, "p99"), BenchLuaNumber (luaState, "max"));
+        }
+        lua_pop (luaState, 1);
+    }
+    if (json) {
+        fprintf (json, "\n]}\n");
+        fclose (json);
+    }
+
+    lua_close (luaState);
+    return 0;
+
+OnErrorExit:
+    lua_close (luaState);
+    return 1;
+
+OnUsageExit:
+    ReplayUsage (argv[0]);
+    return 1;
+}
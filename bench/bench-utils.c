@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Minimal benchmark harness: calibrate iteration count on a warmup run, then
+ * time the loop and count heap allocations through malloc interposition.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "bench-utils.h"
+
+static unsigned long BenchNow (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+int BenchParseArgs (BenchOptsT *opts, int argc, char *argv[]) {
+    int option;
+
+    opts->filter= NULL;
+    opts->timeMs= BENCH_TIME_MS;
+    opts->jsonPath= NULL;
+    opts->json= NULL;
+    opts->count= 0;
+
+    while ((option= getopt (argc, argv, "f:t:j:h")) != -1) {
+        switch (option) {
+            case 'f':
+                opts->filter= optarg;
+                break;
+            case 'j':
+                opts->jsonPath= optarg;
+                break;
+            case 't':
+                opts->timeMs= (unsigned)strtoul (optarg, NULL, 10);
+                if (!opts->timeMs) goto OnErrorExit;
+                break;
+            default:
+                goto OnErrorExit;
+        }
+    }
+    return 0;
+
+OnErrorExit:
+    fprintf (stderr, "usage: %s [-f filter] [-t ms-per-benchmark] [-j results.json]\n", argv[0]);
+    return -1;
+}
+
+// results are written as {"suite":name, "results":[{"name":..., metric:value}]}
+int BenchJsonOpen (BenchOptsT *opts, const char *suite) {
+    if (!opts->jsonPath) return 0;
+
+    opts->json= fopen (opts->jsonPath, "w");
+    if (!opts->json) {
+        fprintf (stderr, "fail to create %s\n", opts->jsonPath);
+        return -1;
+    }
+    fprintf (opts->json, "{\"suite\":\"%s\",\"results\":[", suite);
+    return 0;
+}
+
+void BenchJsonClose (BenchOptsT *opts) {
+    if (!opts->json) return;
+    fprintf (opts->json, "\n]}\n");
+    fclose (opts->json);
+    opts->json= NULL;
+}
+
+static unsigned long BenchLoop (BenchFuncT func, void *context, unsigned long iterations) {
+    unsigned long start= BenchNow();
+    for (unsigned long idx=0; idx < iterations; idx++) func (context);
+    return BenchNow() - start;
+}
+
+// returns 1 when benchmark was skipped by filter
+int BenchRun (BenchOptsT *opts, const char *name, BenchFuncT func, void *context, BenchResultT *result) {
+    unsigned long iterations=1, elapsed, count, bytes;
+
+    if (opts->filter && !strstr (name, opts->filter)) return 1;
+
+    // warmup doubles iterations until loop lasts long enough to extrapolate
+    for (;;) {
+        elapsed= BenchLoop (func, context, iterations);
+        if (elapsed >= BENCH_WARMUP_MS * 1000000UL) break;
+        iterations *= 2;
+    }
+    iterations= (unsigned long)((double)iterations * opts->timeMs * 1000000.0 / (double)elapsed);
+    if (!iterations) iterations= 1;
+
+    BenchAllocStart();
+    elapsed= BenchLoop (func, context, iterations);
+    BenchAllocStop (&count, &bytes);
+
+    result->name= name;
+    result->iterations= iterations;
+    result->nsop= (double)elapsed / (double)iterations;
+    result->allocs= (double)count / (double)iterations;
+    result->bytes= (double)bytes / (double)iterations;
+
+    printf ("%-28s %10lu %12.1f ns/op %10.2f allocs/op %12.1f B/op\n", name, iterations, result->nsop, result->allocs, result->bytes);
+    fflush (stdout);
+
+    if (opts->json) {
+        fprintf (opts->json, "%s\n {\"name\":\"%s\",\"iterations\":%lu,\"nsop\":%.1f,\"allocs\":%.3f,\"bytes\":%.1f}"
+            , opts->count ? "," : "", name, iterations, result->nsop, result->allocs, result->bytes);
+        opts->count++;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define BENCH_TIME_MS 200      // default measuring time per benchmark
+#define BENCH_WARMUP_MS 20     // warmup and calibration time
+
+typedef void (*BenchFuncT) (void *context);
+
+typedef struct {
+    const char *name;
+    unsigned long iterations;
+    double nsop;               // nano-seconds per operation
+    double allocs;             // heap allocations per operation
+    double bytes;              // allocated bytes per operation
+} BenchResultT;
+
+typedef struct {
+    const char *filter;        // only run benchmarks whose name contains filter
+    unsigned timeMs;
+    const char *jsonPath;      // machine readable results (bench-compare input)
+    FILE *json;
+    unsigned count;            // results written to json
+} BenchOptsT;
+
+int  BenchParseArgs (BenchOptsT *opts, int argc, char *argv[]);
+int  BenchJsonOpen (BenchOptsT *opts, const char *suite);
+void BenchJsonClose (BenchOptsT *opts);
+int  BenchRun (BenchOptsT *opts, const char *name, BenchFuncT func, void *context, BenchResultT *result);
+
+// malloc interposition counters (calling thread only)
+void BenchAllocStart (void);
+void BenchAllocStop (unsigned long *count, unsigned long *bytes);
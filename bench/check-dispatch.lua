@@ -0,0 +1,145 @@
+#!/usr/bin/lua
+
+--[[
+Copyright 2021 Fulup Ar Foll fulup@iot.bzh
+Licence: $RP_BEGIN_LICENSE$ SPDX:MIT https://opensource.org/licenses/MIT $RP_END_LICENSE$
+
+object:
+    check-dispatch.lua behaviour check of libafb.evthandler precedence. A private api(chk)
+    pushes one event per name, every event should reach exactly one handler: exact name
+    first, then the matching glob with longest literal prefix, then most literal chars,
+    then first registered. A pattern can only be registered once.
+
+usage
+    - normally started from check-lua C driver (ctest -L check)
+    - from dev tree: LD_LIBRARY_PATH=../afb-libglue/build/src/ lua bench/check-dispatch.lua
+
+config: CHECK={timeout=s}
+    - result is published within CHECK.result={checks=n, failures=n}
+--]]
+
+-- load libafb lua glue (preloaded by check-lua)
+package.cpath="./build/package/lib/?.so;;"
+local libafb=require('afb-luaglue')
+
+local opts    = CHECK or {}
+local checks  = 0
+local failures= 0
+local events  = {}
+local received= {} -- event name -> handler tags
+local count   = 0
+local job
+
+-- registration order matters: 'chk/a/x' group exists before its 'chk/a/' parent
+local handlers = {
+    {tag='ax',    pattern='chk/a/x?'},
+    {tag='all',   pattern='chk/*'},
+    {tag='a',     pattern='chk/a/*'},
+    {tag='ac',    pattern='chk/a/*c'},
+    {tag='exact', pattern='chk/a/b'},
+    {tag='bq',    pattern='chk/b/?'},
+    {tag='b',     pattern='chk/b/*'},
+}
+
+local expected = {
+    {name='a/b',   tag='exact'}, -- exact name wins over every glob
+    {name='a/c',   tag='ac'},    -- same prefix, most literal chars
+    {name='a/d',   tag='a'},
+    {name='a/xb',  tag='ax'},    -- longest literal prefix
+    {name='a/xbc', tag='ac'},    -- nothing matches within prefix group, parent group
+    {name='a/xbd', tag='a'},
+    {name='b/y',   tag='bq'},    -- same prefix and literal chars, first registered
+    {name='b/yy',  tag='b'},
+    {name='z',     tag='all'},
+}
+
+local function expect(label, condition, fmt, ...)
+    checks= checks +1
+    if (not condition) then
+        failures= failures +1
+        io.stderr:write(string.format("FAIL %s: " .. fmt .. "\n", label, ...))
+    end
+end
+
+function ProducerControlCB(api, state)
+    if (state == 'ready') then
+        for _, event in ipairs(expected) do events[event.name]= libafb.evtnew(api, {uid=event.name}) end
+    end
+    return 0
+end
+
+function SubscribeCB(rqt)
+    libafb.evtsubscribe(rqt, '*')
+    return 0
+end
+
+-- leave some time to extra deliveries before releasing jobstart
+function DispatchDoneCB(handle, signum)
+    libafb.jobkill(job, 0)
+end
+
+for _, handler in ipairs(handlers) do
+    _G['Dispatch_' .. handler.tag]= function(evt, name)
+        received[name]= received[name] or {}
+        table.insert(received[name], handler.tag)
+        count= count +1
+        if (count == #expected) then libafb.jobpost(job, 'DispatchDoneCB', 100) end
+    end
+end
+
+function CheckRunCB(handle, signum)
+    job= handle
+    for _, handler in ipairs(handlers) do
+        libafb.evthandler(job, {uid='check-' .. handler.tag, pattern=handler.pattern, callback='Dispatch_' .. handler.tag}, nil)
+    end
+
+    local ok= pcall(libafb.evthandler, job, {uid='check-dup', pattern='chk/a/*', callback='Dispatch_a'}, nil)
+    expect('duplicate', not ok, "pattern 'chk/a/*' registered twice")
+
+    local status= libafb.callsync(job, 'chk', 'subscribe')
+    expect('subscribe', status == 0, "status=%d", status)
+    for _, event in ipairs(expected) do libafb.evtpush(events[event.name], {name=event.name}) end
+    return 0
+end
+
+function CheckStartCB(binder)
+    local status= libafb.jobstart(binder, opts.timeout or 10, 'CheckRunCB', nil)
+    expect('jobstart', status == 0, "status=%d (timeout?)", status)
+
+    for _, event in ipairs(expected) do
+        local tags= received['chk/' .. event.name] or {}
+        expect('chk/' .. event.name, #tags == 1 and tags[1] == event.tag
+            , "expected=%s received=[%s]", event.tag, table.concat(tags, ','))
+    end
+    return 1 -- exit mainloop
+end
+
+local producerVerbs = {
+    {uid='chk-subscribe', verb='subscribe', callback='SubscribeCB', info='subscribe to every chk event'},
+}
+
+local producerApi = {
+    uid     = 'lua-check-chk',
+    api     = 'chk',
+    info    = 'dispatch check event producer',
+    verbose = 0,
+    export  = 'private',
+    control = 'ProducerControlCB',
+    verbs   = producerVerbs,
+}
+
+local checkOpts = {
+    uid     = 'lua-check-dispatch',
+    port    = 0,
+    verbose = 0,
+    rootdir = '.',
+}
+
+local binder= libafb.binder(checkOpts)
+libafb.apiadd(producerApi)
+libafb.loopstart(binder, 'CheckStartCB')
+
+opts.result = {checks=checks, failures=failures}
+if (not CHECK) then
+    print(string.format("checks=%d failures=%d", checks, failures))
+end
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Behaviour check of delta events (LuaEvtDiff): the patch built from a
+ * (previous,next) state pair is applied back as a json merge-patch (rfc7386)
+ * and should give next state again, removed keys should be reported as
+ * cleared dotted paths. Exit status is the number of failures.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-event.h"
+
+typedef struct {
+    const char *label;
+    const char *prev;
+    const char *next;
+    int changed;
+    const char *cleared;  // expected cleared paths
+    const char *result;   // expected patched state, NULL when equal to next
+} CheckEvtT;
+
+static const CheckEvtT checks[]= {
+    {"equal",        "{'a':1,'b':'x'}",              "{'b':'x','a':1}",             0, "[]", NULL},
+    {"nested-equal", "{'s':{'x':1,'y':[1,2]}}",      "{'s':{'y':[1,2],'x':1}}",     0, "[]", NULL},
+    {"modified",     "{'a':1,'b':2}",                "{'a':1,'b':3}",               1, "[]", NULL},
+    {"added",        "{'a':1}",                      "{'a':1,'b':{'c':true}}",      1, "[]", NULL},
+    {"removed",      "{'a':1,'b':2}",                "{'a':1}",                     1, "['b']", NULL},
+    {"nulled",       "{'a':1,'b':2}",                "{'a':1,'b':null}",            1, "['b']", "{'a':1}"},
+    {"sub-removed",  "{'s':{'x':1},'t':1}",          "{'t':1}",                     1, "['s']", NULL},
+    {"nested",       "{'s':{'x':1,'y':2},'t':1}",    "{'s':{'x':1,'z':3},'t':1}",   1, "['s.y']", NULL},
+    {"deep",         "{'a':{'b':{'c':1,'d':2}}}",    "{'a':{'b':{'c':1}}}",         1, "['a.b.d']", NULL},
+    {"to-scalar",    "{'s':{'x':1}}",                "{'s':5}",                     1, "[]", NULL},
+    {"to-object",    "{'s':5}",                      "{'s':{'x':1}}",               1, "[]", NULL},
+    {"array",        "{'l':[1,2]}",                  "{'l':[1,3]}",                 1, "[]", NULL},
+    {"not-object",   "[1,2]",                        "[2]",                         1, "[]", NULL},
+    {NULL}
+};
+
+// json text with single quotes to keep the table readable
+static json_object *CheckParse (const char *text) {
+    char *json= strdup (text);
+    for (char *car= json; *car; car++) if (*car == '\'') *car= '"';
+    json_object *valueJ= json_tokener_parse (json);
+    free (json);
+    return valueJ;
+}
+
+// rfc7386 apply, as done by a delta event subscriber
+static json_object *CheckMergePatch (json_object *targetJ, json_object *patchJ) {
+    json_object *resultJ= NULL;
+
+    if (!json_object_is_type (patchJ, json_type_object)) return json_object_get (patchJ);
+    if (!json_object_is_type (targetJ, json_type_object) || json_object_deep_copy (targetJ, &resultJ, NULL)) resultJ= json_object_new_object();
+
+    json_object_object_foreach (patchJ, key, valueJ) {
+        json_object *oldJ= NULL;
+        if (!valueJ) {
+            json_object_object_del (resultJ, key);
+            continue;
+        }
+        json_object_object_get_ex (resultJ, key, &oldJ);
+        json_object_object_add (resultJ, key, CheckMergePatch (oldJ, valueJ));
+    }
+    return resultJ;
+}
+
+static int CheckDiff (const CheckEvtT *check) {
+    json_object *prevJ= CheckParse (check->prev);
+    json_object *nextJ= CheckParse (check->next);
+    json_object *expectJ= CheckParse (check->result ? check->result : check->next);
+    json_object *clearedJ= json_object_new_array();
+    json_object *expectClearedJ= CheckParse (check->cleared);
+    json_object *patchJ, *resultJ=NULL;
+    int failed=0;
+
+    int changed= LuaEvtDiff (prevJ, nextJ, &patchJ, clearedJ, "");
+    if (changed != check->changed) {
+        fprintf (stderr, "FAIL %s: changed=%d expected=%d\n", check->label, changed, check->changed);
+        failed= 1;
+    }
+    if (!changed && patchJ) {
+        fprintf (stderr, "FAIL %s: unchanged state gave patch=%s\n", check->label, json_object_to_json_string (patchJ));
+        failed= 1;
+    }
+    if (!json_object_equal (clearedJ, expectClearedJ)) {
+        fprintf (stderr, "FAIL %s: cleared=%s expected=%s\n", check->label, json_object_to_json_string (clearedJ), json_object_to_json_string (expectClearedJ));
+        failed= 1;
+    }
+
+    // patch should hold its own references on next state values
+    json_object_put (nextJ);
+    if (changed) {
+        resultJ= CheckMergePatch (prevJ, patchJ);
+        if (!json_object_equal (resultJ, expectJ)) {
+            fprintf (stderr, "FAIL %s: patch=%s gives=%s expected=%s\n", check->label, json_object_to_json_string (patchJ)
+                , json_object_to_json_string (resultJ), json_object_to_json_string (expectJ));
+            failed= 1;
+        }
+    }
+
+    json_object_put (resultJ);
+    json_object_put (patchJ);
+    json_object_put (prevJ);
+    json_object_put (expectJ);
+    json_object_put (clearedJ);
+    json_object_put (expectClearedJ);
+    return failed;
+}
+
+// cleared paths keep caller prefix
+static int CheckPrefix (void) {
+    json_object *prevJ= CheckParse ("{'x':1,'y':2}");
+    json_object *nextJ= CheckParse ("{'x':1}");
+    json_object *clearedJ= json_object_new_array();
+    json_object *patchJ;
+    int failed=0;
+
+    LuaEvtDiff (prevJ, nextJ, &patchJ, clearedJ, "root.");
+    json_object *pathJ= json_object_array_get_idx (clearedJ, 0);
+    if (json_object_array_length (clearedJ) != 1 || strcmp (json_object_get_string (pathJ), "root.y")) {
+        fprintf (stderr, "FAIL prefix: cleared=%s\n", json_object_to_json_string (clearedJ));
+        failed= 1;
+    }
+
+    json_object_put (patchJ);
+    json_object_put (prevJ);
+    json_object_put (nextJ);
+    json_object_put (clearedJ);
+    return failed;
+}
+
+int main (int argc, char *argv[]) {
+    int failures=0, count=0;
+
+    for (int idx=0; checks[idx].label; idx++, count++) failures += CheckDiff (&checks[idx]);
+    failures += CheckPrefix ();
+    count++;
+
+    printf ("%d delta check(s), %d failure(s)\n", count, failures);
+    return failures;
+}
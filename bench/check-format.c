@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Behaviour check of lua log formatter (LuaFmtFormat/LuaFmtArg): flags,
+ * width and precision of every conversion, lua values given to a conversion
+ * of another type and table dumps. Exit status is the number of failures.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua-afb.h"
+#include "lua-format.h"
+
+#define CHECK_MSG_SIZE 256
+
+typedef struct {
+    const char *format;
+    LuaFmtArgT arg;
+    const char *expect;
+} CheckFmtT;
+
+#define ARG_NIL  {.type= LUA_FMT_NIL}
+#define ARG_BOOL(value) {.type= LUA_FMT_BOOL, .integer= value}
+#define ARG_INT(value) {.type= LUA_FMT_INT, .integer= value}
+#define ARG_NUM(value) {.type= LUA_FMT_NUM, .number= value}
+#define ARG_STR(value) {.type= LUA_FMT_STR, .str= {value, sizeof(value)-1}}
+
+static const CheckFmtT checks[]= {
+    {"%s",        ARG_STR("abcdefgh"), "abcdefgh"},
+    {"%.3s",      ARG_STR("abcdefgh"), "abc"},
+    {"%.0s|",     ARG_STR("abcdefgh"), "|"},
+    {"%.20s",     ARG_STR("abc"),      "abc"},
+    {"%-10.3s|",  ARG_STR("abcdefgh"), "abc       |"},
+    {"%6s|",      ARG_STR("abc"),      "   abc|"},
+    {"%-6s|",     ARG_STR("abc"),      "abc   |"},
+    {"%06s|",     ARG_STR("abc"),      "   abc|"},
+    {"%q",        ARG_STR("a\"b\n"),   "\"a\\\"b\\n\""},
+    {"%.2f",      ARG_STR("abcdefgh"), "ab"},
+    {"%8.2f|",    ARG_BOOL(1),         "      tr|"},
+    {"%.2f",      ARG_NIL,             "ni"},
+    {"%5d|",      ARG_NIL,             "  nil|"},
+    {"%.2f",      ARG_NUM(3.14159),    "3.14"},
+    {"%08.3f",    ARG_NUM(-3.14159),   "-003.142"},
+    {"%.1f",      ARG_INT(2),          "2.0"},
+    {"%05d",      ARG_INT(42),         "00042"},
+    {"%-5d|",     ARG_INT(42),         "42   |"},
+    {"%+d",       ARG_INT(42),         "+42"},
+    {"%x",        ARG_INT(255),        "ff"},
+    {"%#X",       ARG_INT(255),        "0XFF"},
+    {"%d",        ARG_NUM(7.9),        "7"},
+    {"%c",        ARG_INT('A'),        "A"},
+    {"%s",        ARG_INT(12),         "12"},
+    {"%s",        ARG_NUM(0.5),        "0.5"},
+    {"%s %s",     ARG_BOOL(0),         "false nil"},
+    {"100%% %s",  ARG_STR("ok"),       "100% ok"},
+    {NULL}
+};
+
+static int CheckFormat (const CheckFmtT *check) {
+    char message[CHECK_MSG_SIZE];
+
+    LuaFmtFormat (message, sizeof(message), check->format, strlen(check->format), 1, &check->arg);
+    if (strcmp (message, check->expect)) {
+        fprintf (stderr, "FAIL format='%s' expect='%s' got='%s'\n", check->format, check->expect, message);
+        return 1;
+    }
+    return 0;
+}
+
+// message longer than buffer ends with truncation mark
+static int CheckTruncate (void) {
+    static const LuaFmtArgT arg= ARG_STR("0123456789012345678901234567890123456789");
+    char message[32];
+
+    size_t len= LuaFmtFormat (message, sizeof(message), "%s", 2, 1, &arg);
+    if (len != sizeof(message)-1 || strcmp (message, "0123456789012345... <truncated>")) {
+        fprintf (stderr, "FAIL truncate got='%s' len=%zu\n", message, len);
+        return 1;
+    }
+    return 0;
+}
+
+// tables are dumped as json text straight from lua
+static int CheckTable (lua_State *luaState, const char *chunk, const char *expect) {
+    char message[CHECK_MSG_SIZE];
+    LuaFmtArgT arg;
+    char *dump;
+    int failed=0;
+
+    if (luaL_dostring (luaState, chunk)) {
+        fprintf (stderr, "FAIL table chunk '%s': %s\n", chunk, lua_tostring (luaState, -1));
+        return 1;
+    }
+    LuaFmtArg (luaState, -1, &arg, &dump);
+    LuaFmtFormat (message, sizeof(message), "%s", 2, 1, &arg);
+    if (strcmp (message, expect)) {
+        fprintf (stderr, "FAIL table '%s' expect='%s' got='%s'\n", chunk, expect, message);
+        failed= 1;
+    }
+    free (dump);
+    lua_pop (luaState, 1);
+    return failed;
+}
+
+int main (int argc, char *argv[]) {
+    int failures=0, count=0;
+
+    for (int idx=0; checks[idx].format; idx++, count++) failures += CheckFormat (&checks[idx]);
+
+    failures += CheckTruncate ();
+    count++;
+
+    lua_State *luaState= luaL_newstate();
+    if (!luaState) return 1;
+    failures += CheckTable (luaState, "return {}", "{}");
+    failures += CheckTable (luaState, "return {1, 2.5, 'x'}", "[1,2.5,\"x\"]");
+    failures += CheckTable (luaState, "return {key='a\"b'}", "{\"key\":\"a\\\"b\"}");
+    failures += CheckTable (luaState, "return {sub={flag=true}}", "{\"sub\":{\"flag\":true}}");
+    count += 4;
+    lua_close (luaState);
+
+    printf ("%d format check(s), %d failure(s)\n", count, failures);
+    return failures;
+}
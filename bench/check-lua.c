@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Lua behaviour check driver: embeds lua with afb-luaglue preloaded, runs a
+ * check script (CHECK table) within a private binder and reports its
+ * CHECK.result {checks, failures}. A script that dies before publishing a
+ * result (lua error, crash, jobstart timeout) fails the check.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "bench-lua.h"
+
+static void CheckUsage (const char *name) {
+    fprintf (stderr, "usage: %s [-t timeout-seconds] script.lua\n", name);
+}
+
+int main (int argc, char *argv[]) {
+    long timeout= 10;
+    lua_State *luaState;
+    int option;
+
+    while ((option= getopt (argc, argv, "t:h")) != -1) {
+        switch (option) {
+            case 't': timeout= strtol (optarg, NULL, 10); break;
+            default:
+                goto OnUsageExit;
+        }
+    }
+    if (optind != argc-1 || timeout <= 0) goto OnUsageExit;
+    const char *script= argv[optind];
+
+    luaState= BenchLuaNew();
+    if (!luaState) return 1;
+
+    lua_newtable (luaState);
+    lua_pushinteger (luaState, timeout);
+    lua_setfield (luaState, -2, "timeout");
+    lua_setglobal (luaState, "CHECK");
+
+    if (luaL_dofile (luaState, script)) {
+        fprintf (stderr, "check-lua: %s\n", lua_tostring (luaState, -1));
+        goto OnErrorExit;
+    }
+
+    lua_getglobal (luaState, "CHECK");
+    lua_getfield (luaState, -1, "result");
+    if (!lua_istable (luaState, -1)) {
+        fprintf (stderr, "check-lua: no result from %s\n", script);
+        goto OnErrorExit;
+    }
+
+    double checks= BenchLuaNumber (luaState, "checks");
+    double failures= BenchLuaNumber (luaState, "failures");
+    printf ("%s: %.0f check(s), %.0f failure(s)\n", script, checks, failures);
+
+    int status= (failures || !checks) ? 1 : 0;
+    lua_close (luaState);
+    return status;
+
+OnErrorExit:
+    lua_close (luaState);
+    return 1;
+
+OnUsageExit:
+    CheckUsage (argv[0]);
+    return 1;
+}
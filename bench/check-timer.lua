@@ -0,0 +1,145 @@
+#!/usr/bin/lua
+
+--[[
+Copyright 2021 Fulup Ar Foll fulup@iot.bzh
+Licence: $RP_BEGIN_LICENSE$ SPDX:MIT https://opensource.org/licenses/MIT $RP_END_LICENSE$
+
+object:
+    check-timer.lua behaviour check of wheel timers, debounce and throttle. Handles
+    are re-armed, disarmed and released from inside their own callbacks, run counts
+    and callback arguments are verified once every timer should be done.
+
+usage
+    - normally started from check-lua C driver (ctest -L check)
+    - from dev tree: LD_LIBRARY_PATH=../afb-libglue/build/src/ lua bench/check-timer.lua
+
+config: CHECK={timeout=s}
+    - result is published within CHECK.result={checks=n, failures=n}
+--]]
+
+-- load libafb lua glue (preloaded by check-lua)
+package.cpath="./build/package/lib/?.so;;"
+local libafb=require('afb-luaglue')
+
+local opts    = CHECK or {}
+local checks  = 0
+local failures= 0
+local runs    = {rearm=0, periodic=0, killer=0, victim=0, debounce=0, throttle=0}
+local triggers= {debounce={}, throttle={}}
+local victim, victimAtUnref
+
+local function expect(label, condition, fmt, ...)
+    checks= checks +1
+    if (not condition) then
+        failures= failures +1
+        io.stderr:write(string.format("FAIL %s: " .. fmt .. "\n", label, ...))
+    end
+end
+
+-- one shot wheel timer re-armed from its own callback, then released from it
+function RearmCB(timer, decount)
+    runs.rearm= runs.rearm +1
+    if (runs.rearm < 3) then
+        libafb.timerreset(timer)
+    else
+        libafb.timerunref(timer)
+    end
+end
+
+-- infinite wheel timer, already relinked for next period when it releases itself
+function PeriodicCB(timer, decount)
+    runs.periodic= runs.periodic +1
+    if (runs.periodic == 5) then libafb.timerunref(timer) end
+end
+
+-- killer and victim expire on same tick, killer runs first and disarms a pending victim
+function KillerCB(timer, decount)
+    runs.killer= runs.killer +1
+    victimAtUnref= runs.victim
+    libafb.timerunref(victim)
+    libafb.timerunref(timer)
+end
+
+function VictimCB(timer, decount)
+    runs.victim= runs.victim +1
+end
+
+-- collapsed trigger bursts, handles are released from their own callback
+function DebounceCB(handle, count, userdata, value)
+    runs.debounce= runs.debounce +1
+    triggers.debounce[runs.debounce]= {count=count, value=value}
+    libafb.timerunref(handle)
+end
+
+function ThrottleCB(handle, count, userdata, value)
+    runs.throttle= runs.throttle +1
+    triggers.throttle[runs.throttle]= {count=count, value=value}
+    if (runs.throttle == 2) then libafb.timerunref(handle) end
+end
+
+local function triggerArgs(mode, run)
+    local args= triggers[mode][run] or {}
+    return tostring(args.count), tostring(args.value)
+end
+
+function CheckDoneCB(job, signum)
+    expect('rearm', runs.rearm == 3, "runs=%d expected=3", runs.rearm)
+    expect('periodic', runs.periodic == 5, "runs=%d expected=5", runs.periodic)
+    expect('disarm', runs.killer == 1 and runs.victim == victimAtUnref
+        , "killer=%d victim=%d victim-at-unref=%s", runs.killer, runs.victim, tostring(victimAtUnref))
+
+    expect('debounce', runs.debounce == 1, "runs=%d expected=1", runs.debounce)
+    local count, value= triggerArgs('debounce', 1)
+    expect('debounce-args', count == '5' and value == '5', "count=%s value=%s expected 5/5", count, value)
+
+    expect('throttle', runs.throttle == 2, "runs=%d expected=2", runs.throttle)
+    count, value= triggerArgs('throttle', 1)
+    expect('throttle-leading', count == '1' and value == '1', "count=%s value=%s expected 1/1", count, value)
+    count, value= triggerArgs('throttle', 2)
+    expect('throttle-trailing', count == '2' and value == '3', "count=%s value=%s expected 2/3", count, value)
+
+    libafb.jobkill(job, 0)
+end
+
+function CheckRunCB(job, signum)
+    libafb.timernew(job, {uid='check-rearm', callback='RearmCB', period=20, count=1, wheel=true}, nil)
+    libafb.timernew(job, {uid='check-periodic', callback='PeriodicCB', period=10, count=0, wheel=true}, nil)
+    libafb.timernew(job, {uid='check-killer', callback='KillerCB', period=30, count=1, wheel=true}, nil)
+    victim= libafb.timernew(job, {uid='check-victim', callback='VictimCB', period=30, count=0, wheel=true}, nil)
+
+    local debounce= libafb.debounce(job, 'DebounceCB', 30)
+    for value=1,5 do libafb.trigger(debounce, value) end
+    expect('debounce-quiet', runs.debounce == 0, "ran within quiet window runs=%d", runs.debounce)
+
+    -- leading edge runs synchronously, following triggers wait for window end
+    local throttle= libafb.throttle(job, 'ThrottleCB', 50)
+    libafb.trigger(throttle, 1)
+    expect('throttle-edge', runs.throttle == 1, "leading trigger runs=%d expected=1", runs.throttle)
+    libafb.trigger(throttle, 2)
+    libafb.trigger(throttle, 3)
+    expect('throttle-window', runs.throttle == 1, "ran within window runs=%d", runs.throttle)
+
+    libafb.jobpost(job, 'CheckDoneCB', 500)
+    return 0
+end
+
+function CheckStartCB(binder)
+    local status= libafb.jobstart(binder, opts.timeout or 10, 'CheckRunCB', nil)
+    expect('jobstart', status == 0, "status=%d (timeout?)", status)
+    return 1 -- exit mainloop
+end
+
+local checkOpts = {
+    uid     = 'lua-check-timer',
+    port    = 0,
+    verbose = 0,
+    rootdir = '.',
+}
+
+local binder= libafb.binder(checkOpts)
+libafb.loopstart(binder, 'CheckStartCB')
+
+opts.result = {checks=checks, failures=failures}
+if (not CHECK) then
+    print(string.format("checks=%d failures=%d", checks, failures))
+end
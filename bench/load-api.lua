@@ -0,0 +1,158 @@
+#!/usr/bin/lua
+
+--[[
+Copyright 2021 Fulup Ar Foll fulup@iot.bzh
+Licence: $RP_BEGIN_LICENSE$ SPDX:MIT https://opensource.org/licenses/MIT $RP_END_LICENSE$
+
+object:
+    load-api.lua loopback load generator, starts a binder with a lua api(load)
+    and drives its verbs with callasync (concurrent lanes) or callsync until
+    duration expires. Latency is measured per request from issue to response.
+
+usage
+    - normally started from bench-load C driver (LOAD table + BenchNow clock)
+    - from dev tree: LD_LIBRARY_PATH=../afb-libglue/build/src/ lua bench/load-api.lua
+
+config: LOAD={mode='async|sync', concurrency=n, payload=bytes, duration=s, verb='echo|ping', uri='unix:@api'}
+    - with uri the api is imported from an other binder instead of local lua api
+--]]
+
+-- load libafb lua glue (preloaded by bench-load)
+package.cpath="./build/package/lib/?.so;;"
+local libafb=require('afb-luaglue')
+
+local opts       = LOAD or {}
+local mode       = opts.mode or 'async'
+local concurrency= opts.concurrency or 8
+local duration   = opts.duration or 5
+local apiname    = opts.api or 'load'
+local verb       = opts.verb or 'echo'
+local now        = BenchNow or function() return math.floor(os.clock() * 1e9) end
+
+local query   = {data=string.rep('x', opts.payload or 64)}
+local samples = {} -- request latency in ns
+local errors  = 0
+local inflight= 0
+local laneStart= {}
+local started, finished, deadline
+
+-- load api verbs: ping (no argument) and echo (argument back in reply)
+function pingCB(rqt)
+    return 0 -- implicit response
+end
+
+function echoCB(rqt, query)
+    return 0, query
+end
+
+-- each lane has its own response callback, lane index gives issue time back
+local function LaneIssue(job, lane)
+    laneStart[lane]= now()
+    inflight= inflight +1
+    libafb.callasync(job, apiname, verb, 'LoadLaneCB' .. lane, nil, query)
+end
+
+local function LaneDone(job, lane, status)
+    local stamp= now()
+    samples[#samples+1]= stamp - laneStart[lane]
+    inflight= inflight -1
+    if (status ~= 0) then errors= errors +1 end
+
+    if (stamp < deadline) then
+        LaneIssue(job, lane)
+    elseif (inflight == 0) then
+        finished= stamp
+        libafb.jobkill(job, 0)
+    end
+end
+
+for lane=1, concurrency do
+    _G['LoadLaneCB' .. lane]= function(job, status) LaneDone(job, lane, status) end
+end
+
+-- run within a job, mainloop keeps dispatching api requests meanwhile
+function LoadRunCB(job, signum)
+    started= now()
+    deadline= started + duration * 1e9
+
+    if (mode == 'sync') then
+        while (now() < deadline) do
+            local start= now()
+            local status= libafb.callsync(job, apiname, verb, query)
+            samples[#samples+1]= now() - start
+            if (status ~= 0) then errors= errors +1 end
+        end
+        finished= now()
+        libafb.jobkill(job, 0)
+    else
+        for lane=1, concurrency do LaneIssue(job, lane) end
+    end
+    return 0
+end
+
+function LoadStartCB(binder)
+    local status= libafb.jobstart(binder, duration + 10, 'LoadRunCB', nil)
+    if (status ~= 0) then
+        libafb.error(binder, "load job fail status=%d", status)
+    end
+    return 1 -- exit mainloop
+end
+
+local loadVerbs = {
+    {uid='load-ping', verb='ping', callback='pingCB', info='empty request/response'},
+    {uid='load-echo', verb='echo', callback='echoCB', info='reply with request argument'},
+}
+
+local loadApi = {
+    uid     = 'lua-load',
+    api     = apiname,
+    info    = 'lua loopback load api',
+    verbose = 0,
+    export  = 'private',
+    verbs   = loadVerbs,
+}
+
+local loadOpts = {
+    uid     = 'lua-load',
+    port    = opts.port or 0,
+    verbose = 0,
+    rootdir = '.',
+}
+
+local binder= libafb.binder(loadOpts)
+if (opts.uri) then
+    libafb.apiadd({uid='lua-load-remote', api=apiname, uri=opts.uri})
+else
+    libafb.apiadd(loadApi)
+end
+libafb.loopstart(binder, 'LoadStartCB')
+
+-- latency percentiles in micro-seconds
+table.sort(samples)
+local function percentile(rank)
+    if (#samples == 0) then return 0 end
+    local index= math.ceil(#samples * rank)
+    if (index < 1) then index= 1 end
+    return samples[index] / 1000
+end
+
+local total= 0
+for _, sample in ipairs(samples) do total= total + sample end
+local elapsed= ((finished or now()) - (started or now())) / 1e9
+
+opts.result = {
+    requests  = #samples,
+    errors    = errors,
+    elapsed   = elapsed,
+    throughput= elapsed > 0 and #samples / elapsed or 0,
+    mean      = #samples > 0 and total / #samples / 1000 or 0,
+    p50       = percentile(0.50),
+    p90       = percentile(0.90),
+    p99       = percentile(0.99),
+    p999      = percentile(0.999),
+    max       = percentile(1),
+}
+
+if (not LOAD) then
+    for key, value in pairs(opts.result) do print(key, value) end
+end
@@ -0,0 +1,172 @@
+#!/usr/bin/lua
+
+--[[
+Copyright 2021 Fulup Ar Foll fulup@iot.bzh
+Licence: $RP_BEGIN_LICENSE$ SPDX:MIT https://opensource.org/licenses/MIT $RP_END_LICENSE$
+
+object:
+    replay-api.lua re-issues verb calls captured with capturestart
+    at original speed (speed=1), accelerated (speed=n) or as fast as possible
+    (speed=0) and measures latency per api/verb.
+
+usage
+    - started from bench-replay C driver (REPLAY table + BenchNow clock)
+    - REPLAY.script: lua api script to replay against, runs in-process. Its
+      loopstart is hooked, its own startup callback still runs first.
+    - REPLAY.uri + REPLAY.api: api imported from an other binder instead
+
+config: REPLAY={records={...}, speed=1.0, concurrency=64, timeout=s, script='my-api.lua', uri='unix:@api', api='name'}
+--]]
+
+package.cpath="./build/package/lib/?.so;;"
+local libafb=require('afb-luaglue')
+
+local opts       = REPLAY or {}
+local records    = opts.records or {}
+local speed      = opts.speed or 1.0
+local concurrency= opts.concurrency or 64
+local now        = BenchNow or function() return math.floor(os.clock() * 1e9) end
+
+local issued, completed, mismatch, inflight= 0, 0, 0, 0
+local slots, freeSlots, verbs= {}, {}, {}
+local job, timer, started, finished, origin
+local userStartCB, userData
+
+-- capture file is written at reply time, replay in arrival order
+table.sort(records, function(a, b) return a.t < b.t end)
+origin= records[1] and records[1].t or 0
+
+local function VerbStat(record)
+    local name= record.api .. '/' .. record.verb
+    local stat= verbs[name]
+    if (not stat) then
+        stat= {name=name, samples={}, captured=0}
+        verbs[name]= stat
+    end
+    return stat
+end
+
+local function ReplayDone()
+    finished= now()
+    if (timer) then libafb.timerunref(timer) end
+    libafb.jobkill(job, 0)
+end
+
+local function ReplayPump()
+    local stamp= now()
+    while (issued < #records and #freeSlots > 0) do
+        local record= records[issued +1]
+        if (speed > 0 and started + (record.t - origin) * 1000 / speed > stamp) then break end
+
+        issued= issued +1
+        local slot= table.remove(freeSlots)
+        slots[slot]= {record=record, start=now()}
+        inflight= inflight +1
+        local ok= pcall(libafb.callasync, job, record.api, record.verb, 'ReplaySlotCB' .. slot, nil, table.unpack(record.params or {}))
+        if (not ok) then
+            -- refused before being issued
+            inflight= inflight -1
+            mismatch= mismatch +1
+            freeSlots[#freeSlots +1]= slot
+        end
+    end
+    if (issued == #records and inflight == 0 and not finished) then ReplayDone() end
+end
+
+local function SlotDone(slot, status)
+    local entry= slots[slot]
+    local stat= VerbStat(entry.record)
+    stat.samples[#stat.samples +1]= now() - entry.start
+    stat.captured= stat.captured + (entry.record.usec or 0)
+
+    -- replayed request should succeed or fail as captured one
+    if ((status < 0) ~= ((entry.record.status or 0) < 0)) then mismatch= mismatch +1 end
+
+    inflight= inflight -1
+    completed= completed +1
+    freeSlots[#freeSlots +1]= slot
+    ReplayPump()
+end
+
+for slot=1, concurrency do
+    _G['ReplaySlotCB' .. slot]= function(handle, status) SlotDone(slot, status) end
+    freeSlots[slot]= slot
+end
+
+function ReplayTickCB(handle)
+    ReplayPump()
+end
+
+function ReplayRunCB(handle)
+    job= handle
+    started= now()
+    if (speed > 0) then
+        timer= libafb.timernew(job, {uid='replay-tick', callback='ReplayTickCB', period=1, count=0}, nil)
+    end
+    ReplayPump()
+    return 0
+end
+
+function ReplayStartCB(binder)
+    if (userStartCB) then userStartCB(binder, userData) end
+
+    local timeout= opts.timeout
+    if (not timeout) then
+        local last= records[#records] and records[#records].t or origin
+        timeout= (speed > 0 and math.ceil((last - origin) / 1e6 / speed) or 0) + 60
+    end
+    libafb.jobstart(binder, timeout, 'ReplayRunCB', nil)
+    return 1 -- exit mainloop
+end
+
+if (opts.script) then
+    -- run target api script, its loopstart runs replay instead of serving forever
+    local loopstart= libafb.loopstart
+    libafb.loopstart= function(binder, callback, userdata)
+        userStartCB= callback and _G[callback]
+        userData= userdata
+        return loopstart(binder, 'ReplayStartCB')
+    end
+    dofile(opts.script)
+else
+    local binder= libafb.binder({uid='lua-replay', port=0, verbose=0, rootdir='.'})
+    libafb.apiadd({uid='lua-replay-remote', api=opts.api, uri=opts.uri})
+    libafb.loopstart(binder, 'ReplayStartCB')
+end
+
+-- latency summary in micro-seconds
+local function Summary(samples, stat)
+    table.sort(samples)
+    local function percentile(rank)
+        if (#samples == 0) then return 0 end
+        return samples[math.max(1, math.ceil(#samples * rank))] / 1000
+    end
+    local total= 0
+    for _, sample in ipairs(samples) do total= total + sample end
+    stat.count= #samples
+    stat.mean= #samples > 0 and total / #samples / 1000 or 0
+    stat.p50= percentile(0.50)
+    stat.p99= percentile(0.99)
+    stat.max= percentile(1)
+    return stat
+end
+
+local all, verbList= {}, {}
+for _, stat in pairs(verbs) do
+    for _, sample in ipairs(stat.samples) do all[#all +1]= sample end
+    stat.captured= stat.captured / math.max(1, #stat.samples)
+    verbList[#verbList +1]= Summary(stat.samples, stat)
+    stat.samples= nil
+end
+table.sort(verbList, function(a, b) return a.name < b.name end)
+
+local elapsed= ((finished or now()) - (started or now())) / 1e9
+opts.result= Summary(all, {
+    records   = #records,
+    completed = completed,
+    lost      = inflight,
+    mismatch  = mismatch,
+    elapsed   = elapsed,
+    throughput= elapsed > 0 and completed / elapsed or 0,
+    verbs     = verbList,
+})
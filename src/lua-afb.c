@@ -36,6 +36,19 @@
 #include "lua-utils.h"
 #include "lua-callbacks.h"
 #include "lua-strict.h"
+#include "lua-pool.h"
+#include "lua-event.h"
+#include "lua-dispatch.h"
+#include "lua-stats.h"
+#include "lua-profile.h"
+#include "lua-hook.h"
+#include "lua-memory.h"
+#include "lua-trace.h"
+#include "lua-gc.h"
+#include "lua-log.h"
+#include "lua-capture.h"
+#include "lua-bytecode.h"
+#include "lua-verbs.h"
 
 // TDB Jose should be removed
 #include <libafb/sys/verbose.h>
@@ -78,7 +91,7 @@ static int GlueTimerAddref(lua_State* luaState) {
     GlueHandleT *glue= LuaTimerPop(luaState, 1);
     if (!glue) goto OnErrorExit;
 
-    afb_timer_addref (glue->timer.afb);
+    if (!glue->timer.wheel) afb_timer_addref (glue->timer.afb);
     json_object_get(glue->timer.configJ);
     glue->usage++;
 
@@ -107,17 +120,54 @@ OnErrorExit:
     return 1;
 }
 
+// restart timer period from now, on wheel timers this is a simple relink (no syscall)
+static int GlueTimerReset(lua_State* luaState) {
+    const char *errorMsg="syntax: timerreset(handle, [period])";
+    int err;
+
+    GlueHandleT *glue= LuaTimerPop(luaState, LUA_FIRST_ARG);
+    if (!glue) goto OnErrorExit;
+
+    if (!lua_isnoneornil(luaState, LUA_FIRST_ARG+1)) {
+        int isNum;
+        lua_Integer period= lua_tointegerx(luaState, LUA_FIRST_ARG+1, &isNum);
+        if (!isNum || period <= 0) goto OnErrorExit;
+        glue->timer.period= (unsigned)period;
+    }
+
+    if (glue->timer.wheel) {
+        err= LuaWheelArm (&glue->timer.node, glue->timer.period, glue->timer.count);
+    } else {
+        // afb timer is recreated, extra references taken with timeraddref would hold the old one
+        if (glue->usage > 0) {
+            errorMsg= "timerreset: timer is shared (timeraddref), unref it first";
+            goto OnErrorExit;
+        }
+        afb_timer_unref (glue->timer.afb);
+        err= afb_timer_create (&glue->timer.afb, 0, 0, 0, glue->timer.count, glue->timer.period, 0, GlueTimerCb, (void*)glue, 0);
+    }
+    if (err) {
+        errorMsg= "(hoops) timer rearm fail";
+        goto OnErrorExit;
+    }
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState,glue, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
 static int GlueTimerNew(lua_State *luaState)
 {
-    const char *errorMsg = "syntax: timernew(api, {'uid':'xxx','callback':yyy,'period':ms,'count':nn}, userdata)";
+    const char *errorMsg = "syntax: timernew(api, {'uid':'xxx','callback':yyy,'period':ms,'count':nn,'wheel':bool}, userdata)";
 
     GlueHandleT *glue= (GlueHandleT *)lua_touserdata(luaState, LUA_FIRST_ARG);
     if (!glue) goto OnErrorExit;
 
     GlueHandleT *handle= (GlueHandleT *)calloc(1, sizeof(GlueHandleT));
     handle->magic = GLUE_TIMER_MAGIC;
-    handle->luaState = lua_newthread(luaState); // private interpretor
-    lua_pushnil(handle->luaState); // keep thread state until timer die
 
     handle->timer.configJ = LuaPopOneArg(luaState, LUA_FIRST_ARG+1);
     json_object_get(handle->timer.configJ);
@@ -138,22 +188,33 @@ static int GlueTimerNew(lua_State *luaState)
             handle->timer.async.userdata= (void*) LuaPopOneArg(luaState, LUA_FIRST_ARG + 2);
     }
 
-    unsigned period, count=0;
     json_object_get(handle->timer.configJ);
-    int err = wrap_json_unpack(handle->timer.configJ, "{ss, ss, si, s?i !}",
+    int err = wrap_json_unpack(handle->timer.configJ, "{ss, ss, si, s?i, s?b !}",
         "uid"     , &handle->timer.async.uid,
         "callback", &handle->timer.async.callback,
-        "period"  , &period,
-        "count"   , &count
+        "period"  , &handle->timer.period,
+        "count"   , &handle->timer.count,
+        "wheel"   , &handle->timer.wheel
     );
     if (err)
     {
-        errorMsg = "timerconfig= {uid=xxx', callback=MyCallback, period=timer(ms), count=0-xx}";
+        errorMsg = "timerconfig= {uid=xxx', callback=MyCallback, period=timer(ms), count=0-xx, wheel=true|false}";
         goto OnErrorExit;
     }
 
-    // Fulup TBD check how to implement autounref
-    err= afb_timer_create (&handle->timer.afb, 0, 0, 0, count, period, 0, GlueTimerCb, (void*)handle, 0);
+    if (handle->timer.wheel) {
+        // wheel timers share one afb timer and one interpretor thread
+        handle->luaState = LuaWheelThread(luaState);
+        handle->timer.node.callback= GlueWheelCb;
+        handle->timer.node.context= handle;
+        err= LuaWheelArm (&handle->timer.node, handle->timer.period, handle->timer.count);
+    } else {
+        handle->luaState = lua_newthread(luaState); // private interpretor
+        lua_pushnil(handle->luaState); // keep thread state until timer die
+
+        // Fulup TBD check how to implement autounref
+        err= afb_timer_create (&handle->timer.afb, 0, 0, 0, handle->timer.count, handle->timer.period, 0, GlueTimerCb, (void*)handle, 0);
+    }
     if (err) {
         errorMsg= "(hoops) afb_timer_create fail";
         goto OnErrorExit;
@@ -169,11 +230,114 @@ OnErrorExit:
     return 1;
 }
 
+// debounce/throttle are wheel timers collapsing trigger bursts into one lua call
+static int GlueTriggerNew(lua_State *luaState, LuaTimerModeE mode)
+{
+    const char *errorMsg = "syntax: debounce|throttle(handle, callback, ms, [userdata])";
+    GlueHandleT *handle=NULL;
+
+    GlueHandleT *glue= (GlueHandleT *)lua_touserdata(luaState, LUA_FIRST_ARG);
+    if (!glue) goto OnErrorExit;
+
+    const char *callback= lua_tostring(luaState, LUA_FIRST_ARG+1);
+    if (!callback) goto OnErrorExit;
+
+    int isNum;
+    lua_Integer period= lua_tointegerx(luaState, LUA_FIRST_ARG+2, &isNum);
+    if (!isNum || period <= 0) goto OnErrorExit;
+
+    handle= (GlueHandleT *)calloc(1, sizeof(GlueHandleT));
+    handle->magic = GLUE_TIMER_MAGIC;
+    handle->luaState = LuaWheelThread(luaState);
+    handle->timer.apiv4= GlueGetApi(glue);
+    handle->timer.mode= mode;
+    handle->timer.wheel= 1;
+    handle->timer.period= (unsigned)period;
+    handle->timer.count= 1;
+    handle->timer.valueRef= LUA_NOREF;
+    handle->timer.async.callback= (char*)LuaStrIntern(callback);
+    handle->timer.async.uid= handle->timer.async.callback;
+    handle->timer.node.callback= GlueWheelCb;
+    handle->timer.node.context= handle;
+    wrap_json_pack (&handle->timer.configJ, "{ss si}", "callback", callback, "period", (int)period);
+    json_object_get(handle->timer.configJ);
+
+    switch (lua_type(luaState, LUA_FIRST_ARG + 3)) {
+        case LUA_TLIGHTUSERDATA:
+            handle->timer.async.userdata= lua_touserdata(luaState, LUA_FIRST_ARG+3);
+            break;
+        case LUA_TNONE:
+        case LUA_TNIL:
+            handle->timer.async.userdata=NULL;
+            break;
+        default:
+            handle->timer.async.userdata= (void*) LuaPopOneArg(luaState, LUA_FIRST_ARG + 3);
+    }
+
+    lua_pushlightuserdata(luaState, handle);
+    return 1;
+
+OnErrorExit:
+    if (handle) free (handle);
+    LUA_DBG_ERROR(luaState,glue,errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueDebounce(lua_State *luaState)
+{
+    return GlueTriggerNew (luaState, LUA_TIMER_DEBOUNCE);
+}
+
+static int GlueThrottle(lua_State *luaState)
+{
+    return GlueTriggerNew (luaState, LUA_TIMER_THROTTLE);
+}
+
+static int GlueTrigger(lua_State *luaState)
+{
+    const char *errorMsg="syntax: trigger(handle, [value])";
+
+    GlueHandleT *glue= LuaTimerPop(luaState, LUA_FIRST_ARG);
+    if (!glue || glue->timer.mode == LUA_TIMER_PERIODIC) goto OnErrorExit;
+
+    // keep only last trigger value
+    if (glue->timer.valueRef != LUA_NOREF) luaL_unref(luaState, LUA_REGISTRYINDEX, glue->timer.valueRef);
+    lua_settop(luaState, LUA_FIRST_ARG+1);
+    glue->timer.valueRef= luaL_ref(luaState, LUA_REGISTRYINDEX);
+    glue->timer.triggers++;
+
+    switch (glue->timer.mode) {
+        case LUA_TIMER_DEBOUNCE:
+            // each trigger pushes quiet window deadline back
+            if (LuaWheelArm (&glue->timer.node, glue->timer.period, 1)) goto OnErrorExit;
+            break;
+
+        case LUA_TIMER_THROTTLE:
+            // leading edge runs now and opens window, other triggers wait for window end
+            if (!LuaWheelIsArmed (&glue->timer.node)) {
+                if (LuaWheelArm (&glue->timer.node, glue->timer.period, 1)) goto OnErrorExit;
+                GlueTriggerRun (glue, luaState);
+            }
+            break;
+
+        default:
+            goto OnErrorExit;
+    }
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState,glue, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
 static int GlueRespond(lua_State *luaState)
 {
     const char *errorMsg =  "syntax: response(RQT, status, [arg1 ... argn])";
     unsigned argc = lua_gettop(luaState);
-    json_object *argsJ[argc];
     afb_data_t reply[argc];
 
     GlueHandleT *glue = LuaRqtPop(luaState, LUA_FIRST_ARG);
@@ -185,16 +349,16 @@ static int GlueRespond(lua_State *luaState)
     if (!isnum) goto OnErrorExit;
 
     // get response from LUA and push them as afb-v4 object
+    LuaMarshalT marshalMark= luaMarshal[LUA_MARSHAL_FROMLUA];
     for (int idx = 0; idx < argc - 2; idx++)
     {
-        argsJ[idx] = LuaPopOneArg(luaState, LUA_FIRST_ARG + idx + 2);
-        if (!argsJ[idx])
+        if (LuaPopOneData(luaState, LUA_FIRST_ARG + idx + 2, &reply[idx]))
         {
             errorMsg = "error pushing arguments";
             goto OnErrorExit;
         }
-        afb_create_data_raw(&reply[idx], AFB_PREDEFINED_TYPE_JSON_C, argsJ[idx], 0, (void *)json_object_put, argsJ[idx]);
     }
+    if (glue->rqt.stats) LuaMarshalAdd (&glue->rqt.stats->marshal[LUA_MARSHAL_FROMLUA], &marshalMark, LUA_MARSHAL_FROMLUA);
 
     GlueReply(glue, status, argc - 2, reply);
     return 0;
@@ -219,19 +383,16 @@ static int GlueEvtPush(lua_State *luaState)
     afb_data_t reply[argc];
 
     // check evt handle
-    afb_event_t evtid = (afb_event_t)lua_touserdata(luaState, LUA_FIRST_ARG);;
-    if (!evtid || !afb_event_is_valid(evtid)) goto OnErrorExit;
+    GlueHandleT *glue= LuaEventPop(luaState, LUA_FIRST_ARG);
+    if (!glue || !afb_event_is_valid(glue->event.afb)) goto OnErrorExit;
 
     // get response from LUA and push them as afb-v4 object
     for (index = 0; index < argc - 1; index++)
     {
-        json_object *argsJ;
-        argsJ = LuaPopOneArg(luaState, LUA_FIRST_ARG + index + 1);
-        if (!argsJ) goto OnErrorExit;
-        afb_create_data_raw(&reply[index], AFB_PREDEFINED_TYPE_JSON_C, argsJ, 0, (void *)json_object_put, argsJ);
+        if (LuaPopOneData(luaState, LUA_FIRST_ARG + index + 1, &reply[index])) goto OnErrorExit;
     }
 
-    int status = afb_event_push(evtid, index, reply);
+    int status = LuaEvtPush(glue, index, reply);
     if (status < 0)
     {
         errorMsg = "afb_event_push fail";
@@ -240,69 +401,226 @@ static int GlueEvtPush(lua_State *luaState)
     return 0;
 
 OnErrorExit: {
-    GlueHandleT *glue= LuaBinderPop(luaState);
-    LUA_DBG_ERROR(luaState, glue, errorMsg);
+    GlueHandleT *binder= LuaBinderPop(luaState);
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
     lua_pushstring(luaState, errorMsg);
     lua_error(luaState);
     return 1;
   }
 }
 
-static int GlueEvtSubscribe(lua_State *luaState)
+// push the same payload to many events converting it only once
+static int GlueEvtPushMany(lua_State *luaState)
 {
-    const char *errorMsg = "syntax: subscribe(rqt, evtid)";
+    const char *errorMsg = "syntax: evtpushmany({evt1,...,evtn}, [arg1...argn]) | evtpushmany({{evt1, arg...},...,{evtn, arg...}})";
+    unsigned argc = lua_gettop(luaState);
+    unsigned count= 0;
+    int err, nparams=0;
+    afb_data_t params[LUA_EVT_MAX_PARAMS];
 
-    // check evt handle
-    GlueHandleT *glue= LuaRqtPop(luaState, LUA_FIRST_ARG);
-    if (!glue) goto OnErrorExit;
+    if (!lua_istable(luaState, LUA_FIRST_ARG)) goto OnErrorExit;
+    size_t nevts= lua_rawlen(luaState, LUA_FIRST_ARG);
 
-    afb_event_t evtid = (afb_event_t)lua_touserdata(luaState, LUA_FIRST_ARG+1);
-    if (!evtid || !afb_event_is_valid(evtid)) goto OnErrorExit;
+    // pairs mode {{evt, payload...},...} each event has its own payload
+    lua_rawgeti(luaState, LUA_FIRST_ARG, 1);
+    int pairs= (argc == 1 && lua_istable(luaState, -1));
+    lua_pop(luaState, 1);
 
-    int err = afb_req_subscribe(glue->rqt.afb, evtid);
-    if (err)
-    {
-        errorMsg = "(hoops) afb_req_subscribe fail";
+    if (!pairs) {
+        if (argc-1 > LUA_EVT_MAX_PARAMS) goto OnErrorExit;
+        for (nparams = 0; nparams < argc - 1; nparams++)
+        {
+            if (LuaPopOneData(luaState, LUA_FIRST_ARG + nparams + 1, &params[nparams])) goto OnErrorExit;
+        }
+    }
+
+    for (int idx=1; idx <= nevts; idx++) {
+        afb_data_t data[LUA_EVT_MAX_PARAMS];
+        GlueHandleT *glue;
+        int ndata;
+
+        lua_rawgeti(luaState, LUA_FIRST_ARG, idx);
+        if (!pairs) {
+            glue= LuaEventPop(luaState, -1);
+            for (ndata=0; ndata < nparams; ndata++) data[ndata]= afb_data_addref(params[ndata]);
+        } else {
+            int top= lua_gettop(luaState);
+            if (!lua_istable(luaState, top)) goto OnPairError;
+            lua_rawgeti(luaState, top, 1);
+            glue= LuaEventPop(luaState, -1);
+            lua_pop(luaState, 1);
+
+            int npayload= (int)lua_rawlen(luaState, top) -1;
+            if (npayload > LUA_EVT_MAX_PARAMS) goto OnPairError;
+            for (ndata=0; ndata < npayload; ndata++) {
+                lua_rawgeti(luaState, top, ndata+2);
+                err= LuaPopOneData(luaState, -1, &data[ndata]);
+                lua_pop(luaState, 1);
+                if (err) {
+                    for (int jdx=0; jdx < ndata; jdx++) afb_data_unref(data[jdx]);
+                    goto OnPairError;
+                }
+            }
+        }
+        lua_pop(luaState, 1);
+
+        if (!glue || !afb_event_is_valid(glue->event.afb)) {
+            for (int jdx=0; jdx < ndata; jdx++) afb_data_unref(data[jdx]);
+            continue;
+        }
+
+        // LuaEvtPush consumes one reference on each data
+        err= LuaEvtPush (glue, ndata, data);
+        if (err >= 0) count++;
+        continue;
+
+    OnPairError:
+        lua_pop(luaState, 1);
+        errorMsg= "evtpushmany: invalid {evt, arg...} pair";
         goto OnErrorExit;
     }
-    return 0;
 
-OnErrorExit:
-    LUA_DBG_ERROR(luaState,glue, errorMsg);
+    for (int idx=0; idx < nparams; idx++) afb_data_unref(params[idx]);
+    lua_pushinteger(luaState, count);
+    return 1;
+
+OnErrorExit: {
+    GlueHandleT *binder= LuaBinderPop(luaState);
+    for (int idx=0; idx < nparams; idx++) afb_data_unref(params[idx]);
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
     lua_pushstring(luaState, errorMsg);
     lua_error(luaState);
     return 1;
+  }
 }
 
-static int GlueEvtUnsubscribe(lua_State *luaState)
+static int GlueEvtSubscribeOne(lua_State *luaState, GlueHandleT *glue, GlueHandleT *event, int subscribe)
 {
-    const char *errorMsg = "syntax: unsubscribe(rqt, evtid)";
+    int err;
 
-    GlueHandleT *glue = LuaRqtPop(luaState, LUA_FIRST_ARG);
-    if (!glue) goto OnErrorExit;
+    if (!event || !afb_event_is_valid(event->event.afb)) goto OnErrorExit;
 
-    afb_event_t evtid = (afb_event_t)lua_touserdata(luaState, LUA_FIRST_ARG+1);
-    if (!evtid || !afb_event_is_valid(evtid)) goto OnErrorExit;
+    if (!subscribe) {
+        err = afb_req_unsubscribe(glue->rqt.afb, event->event.afb);
+        if (err) goto OnErrorExit;
+        return 0;
+    }
 
-    int err = afb_req_unsubscribe(glue->rqt.afb, evtid);
-    if (err)
-    {
-        errorMsg = "(hoops) afb_req_unsubscribe fail";
+    err = afb_req_subscribe(glue->rqt.afb, event->event.afb);
+    if (err) goto OnErrorExit;
+
+    // return last pushed payloads, they can be used as is within rqt reply
+    return LuaEvtReplay(event, luaState);
+
+OnErrorExit:
+    return -1;
+}
+
+// one event handle, a list of handles or a pattern resolved against api events
+static int GlueEvtSubscription(lua_State *luaState, int subscribe)
+{
+    const char *errorMsg = subscribe
+        ? "syntax: [replay...]= evtsubscribe(rqt, evtid|{evtid,...}|'pattern')"
+        : "syntax: evtunsubscribe(rqt, evtid|{evtid,...}|'pattern')";
+    int status, count=0, replay=0;
+
+    GlueHandleT *glue= LuaRqtPop(luaState, LUA_FIRST_ARG);
+    if (!glue) goto OnErrorExit;
+
+    // replayed payloads are returned as varargs, check stack room before any subscription
+    switch (lua_type(luaState, LUA_FIRST_ARG+1)) {
+        case LUA_TLIGHTUSERDATA: {
+            GlueHandleT *event= LuaEventPop(luaState, LUA_FIRST_ARG+1);
+            if (event) replay= LuaEvtReplayCount(event);
+            break;
+        }
+        case LUA_TTABLE: {
+            size_t nevts= lua_rawlen(luaState, LUA_FIRST_ARG+1);
+            for (int idx=1; idx <= nevts; idx++) {
+                lua_rawgeti(luaState, LUA_FIRST_ARG+1, idx);
+                GlueHandleT *event= LuaEventPop(luaState, -1);
+                lua_pop(luaState, 1);
+                if (event) replay += LuaEvtReplayCount(event);
+            }
+            break;
+        }
+        case LUA_TSTRING: {
+            afb_api_t apiv4= afb_req_get_api(glue->rqt.afb);
+            GlueHandleT *event;
+            int cursor=0;
+            while ((event= LuaEvtFind(apiv4, lua_tostring(luaState, LUA_FIRST_ARG+1), &cursor))) replay += LuaEvtReplayCount(event);
+            break;
+        }
+    }
+    if (subscribe && replay && !lua_checkstack(luaState, replay)) {
+        errorMsg= "evtsubscribe: too many replayed payloads, subscribe fewer events at once";
         goto OnErrorExit;
     }
-    return 0;
 
+    switch (lua_type(luaState, LUA_FIRST_ARG+1)) {
+        case LUA_TLIGHTUSERDATA:
+            count= GlueEvtSubscribeOne(luaState, glue, LuaEventPop(luaState, LUA_FIRST_ARG+1), subscribe);
+            if (count < 0) goto OnSubscribeError;
+            break;
+
+        case LUA_TTABLE: {
+            size_t nevts= lua_rawlen(luaState, LUA_FIRST_ARG+1);
+            for (int idx=1; idx <= nevts; idx++) {
+                lua_rawgeti(luaState, LUA_FIRST_ARG+1, idx);
+                GlueHandleT *event= LuaEventPop(luaState, -1);
+                lua_pop(luaState, 1);
+
+                status= GlueEvtSubscribeOne(luaState, glue, event, subscribe);
+                if (status < 0) goto OnSubscribeError;
+                count += status;
+            }
+            break;
+        }
+
+        case LUA_TSTRING: {
+            const char *pattern= lua_tostring(luaState, LUA_FIRST_ARG+1);
+            afb_api_t apiv4= afb_req_get_api(glue->rqt.afb);
+            GlueHandleT *event;
+            int cursor=0;
+
+            while ((event= LuaEvtFind(apiv4, pattern, &cursor))) {
+                status= GlueEvtSubscribeOne(luaState, glue, event, subscribe);
+                if (status < 0) goto OnSubscribeError;
+                count += status;
+            }
+            break;
+        }
+
+        default:
+            goto OnErrorExit;
+    }
+    return count;
+
+OnSubscribeError:
+    errorMsg = subscribe ? "(hoops) afb_req_subscribe fail" : "(hoops) afb_req_unsubscribe fail";
 OnErrorExit:
-    LUA_DBG_ERROR(luaState, glue, errorMsg);
+    LUA_DBG_ERROR(luaState,glue, errorMsg);
     lua_pushstring(luaState, errorMsg);
     lua_error(luaState);
     return 1;
 }
 
+static int GlueEvtSubscribe(lua_State *luaState)
+{
+    return GlueEvtSubscription(luaState, 1);
+}
+
+static int GlueEvtUnsubscribe(lua_State *luaState)
+{
+    return GlueEvtSubscription(luaState, 0);
+}
+
 static int GlueEvtNew(lua_State *luaState)
 {
-    const char *errorMsg= "syntax: evtid= eventnew(api,label)";
-    afb_event_t evtid;
+    const char *errorMsg= "syntax: evtid= eventnew(api,label|{uid='xxx',coalesce=ms,mode='latest|batch',replay=count,delta=bool})";
+    GlueHandleT *handle=NULL;
+    json_object *configJ=NULL;
+    const char *label;
     int err;
 
     GlueHandleT *glue= LuaApiPop(luaState, LUA_FIRST_ARG);
@@ -312,21 +630,53 @@ static int GlueEvtNew(lua_State *luaState)
         goto OnErrorExit;
     }
 
-    const char *label= lua_tostring(luaState, LUA_FIRST_ARG+1);
-    if (!label) goto OnErrorExit;
+    // event is either a simple label or a config table
+    switch (lua_type(luaState, LUA_FIRST_ARG+1)) {
+        case LUA_TSTRING:
+            // lua string may be collected, label should point within configJ
+            wrap_json_pack (&configJ, "{ss}", "uid", lua_tostring(luaState, LUA_FIRST_ARG+1));
+            if (!configJ || wrap_json_unpack(configJ, "{ss}", "uid", &label)) goto OnErrorExit;
+            break;
+        case LUA_TTABLE:
+            configJ= LuaPopOneArg(luaState, LUA_FIRST_ARG+1);
+            if (!configJ || wrap_json_unpack(configJ, "{ss}", "uid", &label)) goto OnErrorExit;
+            break;
+        default:
+            goto OnErrorExit;
+    }
 
-    err= afb_api_new_event(GlueGetApi(glue), label, &evtid);
+    handle= calloc(1, sizeof(GlueHandleT));
+    handle->magic = GLUE_EVT_MAGIC;
+    handle->luaState= luaState;
+    handle->event.apiv4= GlueGetApi(glue);
+    handle->event.configJ= configJ;
+    handle->event.async.uid= (char*)label;
+
+    errorMsg= LuaEvtConfig (handle, configJ);
+    if (errorMsg) goto OnErrorExit;
+
+    err= afb_api_new_event(handle->event.apiv4, label, &handle->event.afb);
     if (err)
     {
         errorMsg = "(hoops) afb-afb_api_new_event fail";
         goto OnErrorExit;
     }
+    if (LuaEvtRegister(handle)) {
+        afb_event_unref(handle->event.afb);
+        errorMsg = "fail to register event";
+        goto OnErrorExit;
+    }
 
-    // push evtid as a LUA opaque handle
-    lua_pushlightuserdata(luaState, evtid);
+    // push event glue as a LUA opaque handle
+    lua_pushlightuserdata(luaState, handle);
     return 1;
 
 OnErrorExit:
+    if (handle) {
+        free (handle->event.ring);
+        free (handle);
+    }
+    if (configJ) json_object_put (configJ);
     LUA_DBG_ERROR(luaState,glue, errorMsg);
     lua_pushnil(luaState);
     lua_pushstring(luaState, errorMsg);
@@ -340,6 +690,7 @@ static int GlueCallAsync(lua_State *luaState)
     unsigned argc = lua_gettop(luaState);
     json_object *argsJ[argc];
     afb_data_t params[argc];
+    GlueCallHandleT *handle= NULL;
 
     GlueHandleT *glue = (GlueHandleT *)lua_touserdata(luaState, LUA_FIRST_ARG);
     if (!glue || !GlueGetApi(glue)) goto OnErrorExit;
@@ -364,6 +715,22 @@ static int GlueCallAsync(lua_State *luaState)
 
     if (!apiname || !verbname || !callback) goto OnErrorExit;
 
+    // control block come from slab pool, uid and callback name are interned once
+    handle= LuaPoolGet(&glueCallPool);
+    if (!handle) {
+        errorMsg= "callasync: out of memory";
+        goto OnErrorExit;
+    }
+    handle->magic= GLUE_CALL_MAGIC;
+    handle->glue=glue;
+    handle->async.uid= (char*)LuaUidIntern(apiname, verbname);
+    handle->async.userdata= userdata;
+    handle->async.callback= (char*)LuaStrIntern(callback);
+    if (!handle->async.uid || !handle->async.callback) {
+        errorMsg= "callasync: api/verb name too long";
+        goto OnErrorExit;
+    }
+
     // retreive subcall api argument(s)
     int index;
     for (index = 0; index < argc-(LUA_FIRST_ARG+4); index++)
@@ -377,12 +744,8 @@ static int GlueCallAsync(lua_State *luaState)
         afb_create_data_raw(&params[index], AFB_PREDEFINED_TYPE_JSON_C, argsJ[index], 0, (void *)json_object_put, argsJ[index]);
     }
 
-    GlueCallHandleT *handle= calloc(1,sizeof(GlueCallHandleT));
-    handle->magic= GLUE_CALL_MAGIC;
-    handle->glue=glue;
-    asprintf (&handle->async.uid, "%s/%s", apiname, verbname);
-    handle->async.userdata= userdata;
-    handle->async.callback= strdup(callback);
+    handle->span= LuaTraceCurrent();
+    if (handle->span) handle->issued= LuaStatsNow();
 
     switch (glue->magic) {
         case GLUE_RQT_MAGIC:
@@ -396,6 +759,7 @@ static int GlueCallAsync(lua_State *luaState)
     return 1;
 
 OnErrorExit:
+    LuaPoolPut (&glueCallPool, handle);
     LUA_DBG_ERROR(luaState,glue, errorMsg);
     lua_pushinteger (glue->luaState, -1);
     lua_pushstring(luaState, errorMsg);
@@ -434,6 +798,11 @@ static int GlueCallSync(lua_State *luaState)
             afb_create_data_raw(&params[index], AFB_PREDEFINED_TYPE_JSON_C, argsJ, 0, (void *)json_object_put, argsJ);
         }
 
+        // nested lua verbs start outside of current lua context
+        LuaHookCtxT hookCtx;
+        LuaSpanT span;
+        LuaTraceBegin (&span, "callsync", apiname, verbname, 0, 0);
+        LuaHookEnter (&hookCtx, NULL, NULL);
         switch (glue->magic) {
             case GLUE_RQT_MAGIC:
                 err= afb_req_subcall_sync (glue->rqt.afb, apiname, verbname, index, params, afb_req_subcall_catch_events, &status, &nreplies, replies);
@@ -445,9 +814,13 @@ static int GlueCallSync(lua_State *luaState)
                 break;
 
             default:
+                LuaHookLeave (&hookCtx);
+                LuaTraceEnd (&span);
                 errorMsg = "handle should be a req|api";
                 goto OnErrorExit;
         }
+        LuaHookLeave (&hookCtx);
+        LuaTraceEnd (&span);
         if (err) {
             status   = err;
             errorMsg= "(hoops) afb_subcall_sync fail";
@@ -495,7 +868,7 @@ static int GlueJobStart(lua_State *luaState)
     handle->luaState= luaState;
     handle->job.apiv4= GlueGetApi(glue);
     handle->job.dataJ= (void*) LuaPopOneArg(luaState, LUA_FIRST_ARG + 2);
-    handle->job.async.callback= strdup(funcname);
+    handle->job.async.callback= (char*)LuaStrIntern(funcname);
 
     int luaType= lua_type(luaState, LUA_FIRST_ARG + 3);
     switch (luaType) {
@@ -509,7 +882,10 @@ static int GlueJobStart(lua_State *luaState)
             handle->job.async.userdata= (void*) LuaPopOneArg(luaState, LUA_FIRST_ARG + 3);
     }
 
+    LuaHookCtxT hookCtx;
+    LuaHookEnter (&hookCtx, NULL, NULL);
     err= afb_sched_enter(NULL, timeout, GlueJobStartCb, handle);
+    LuaHookLeave (&hookCtx);
     if (err < 0) {
         errorMsg= "afb_sched_enter (timeout?)";
         handle->job.status=-1;
@@ -520,10 +896,7 @@ static int GlueJobStart(lua_State *luaState)
     return 1;
 
 OnErrorExit:
-    if (handle) {
-        if (handle->job.async.callback) free (handle->job.async.callback);
-        free (handle);
-    }
+    if (handle) free (handle);
     LUA_DBG_ERROR(luaState,glue, errorMsg);
     lua_pushinteger (luaState, -1);
     lua_pushstring(luaState, errorMsg);
@@ -554,7 +927,11 @@ OnErrorExit:
 static int GlueJobPost(lua_State *luaState)
 {
     const char *errorMsg = "syntax: jobpost(handle,callback,timeout,[,userdata])";
-    GlueCallHandleT *handle=calloc (1, sizeof(GlueCallHandleT));
+    GlueCallHandleT *handle= LuaPoolGet(&glueCallPool);
+    if (!handle) {
+        errorMsg= "jobpost: out of memory";
+        goto OnErrorExit;
+    }
     handle->magic= GLUE_POST_MAGIC;
 
     handle->glue = (GlueHandleT *)lua_touserdata(luaState, LUA_FIRST_ARG);
@@ -562,7 +939,8 @@ static int GlueJobPost(lua_State *luaState)
 
     const char* callback= lua_tostring(luaState, LUA_FIRST_ARG + 1);
     if (!callback) goto OnErrorExit;
-    handle->async.callback= strdup(callback);
+    handle->async.callback= (char*)LuaStrIntern(callback);
+    if (!handle->async.callback) goto OnErrorExit;
 
     int isNum;
     int timeout = (int) lua_tointegerx (luaState, LUA_FIRST_ARG+2, &isNum);
@@ -588,9 +966,8 @@ static int GlueJobPost(lua_State *luaState)
     return 1;
 
 OnErrorExit:
-    if (handle->async.callback) free (handle->async.callback);
-    free (handle);
-    LUA_DBG_ERROR(luaState,handle->glue, errorMsg);
+    LUA_DBG_ERROR(luaState, handle ? handle->glue : NULL, errorMsg);
+    LuaPoolPut (&glueCallPool, handle);
     lua_pushinteger (luaState, -1);
     return 1;
 }
@@ -675,8 +1052,15 @@ static int GlueEvtHandler(lua_State *luaState)
     handle->event.async.uid= (char*)uid;
     handle->event.configJ= configJ;
 
-    errorMsg= AfbAddOneEvent (apiv4, uid, pattern, GlueEventCb, handle);
-    if (errorMsg) goto OnErrorExit;
+    handle->event.pattern= (char*)pattern;
+
+    // exact names get their own afb handler, globs share one afb handler per literal prefix
+    errorMsg= LuaDispatchAdd (apiv4, pattern, handle);
+    if (errorMsg) {
+        json_object_put(handle->event.configJ);
+        free(handle);
+        goto OnErrorExit;
+    }
 
     return 0;
 
@@ -723,6 +1107,27 @@ OnErrorExit:
     return 1;
 }
 
+// verbsadd(api, verbs) register a whole verb array in one pass
+static int GlueVerbsAdd(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: verbsadd(api, {verb1, verb2, ...})";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    GlueHandleT *glue = LuaApiPop(luaState, LUA_FIRST_ARG);
+    if (!glue || !glue->api.afb) goto OnErrorExit;
+
+    errorMsg= LuaVerbsAdd(luaState, binder, glue, LUA_FIRST_ARG + 1);
+    if (errorMsg) goto OnErrorExit;
+
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState,glue, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
 static int GlueSetLoa(lua_State *luaState)
 {
     const char *errorMsg = "syntax: setloa(rqt, newloa)";
@@ -787,7 +1192,7 @@ OnErrorExit:
 static int GlueGetConfig(lua_State *luaState)
 {
     const char *errorMsg = "syntax: config(handle[,key])";
-    json_object *configJ;
+    json_object *configJ, *fullJ=NULL;
 
     GlueHandleT *binder = LuaBinderPop(luaState);
     assert(binder);
@@ -800,6 +1205,11 @@ static int GlueGetConfig(lua_State *luaState)
     {
     case GLUE_API_MAGIC:
         configJ = glue->api.configJ;
+        // bulk registered verbs are not kept within api config
+        if (configJ && glue->api.afb && !json_object_object_get_ex(configJ, "verbs", NULL)) {
+            fullJ= LuaVerbsConfig(glue->api.afb, configJ);
+            configJ= fullJ;
+        }
         break;
     case GLUE_BINDER_MAGIC:
         configJ = glue->binder.configJ;
@@ -832,6 +1242,7 @@ static int GlueGetConfig(lua_State *luaState)
         if (!slotJ) lua_pushnil(luaState);
         else LuaPushOneArg(luaState, slotJ);
     }
+    if (fullJ) json_object_put(fullJ);
     return 1;
 
 OnErrorExit:
@@ -880,6 +1291,56 @@ OnErrorExit:
 }
 
 
+// introspection=true|{stats=bool, profile=bool, trace=bool, permission='xxx', loa=n} control verbs are opt-in
+static const char *GlueApiIntrospect(GlueHandleT *glue, json_object *introJ)
+{
+    const char *permission=NULL;
+    int stats=0, profile=0, trace=0, loa=0, err;
+    struct afb_auth *auth=NULL, *introspect= glue->api.introspect;
+
+    if (json_object_is_type(introJ, json_type_boolean)) {
+        stats= profile= trace= json_object_get_boolean(introJ);
+    } else {
+        err= wrap_json_unpack(introJ, "{s?b s?b s?b s?s s?i !}"
+            ,"stats", &stats
+            ,"profile", &profile
+            ,"trace", &trace
+            ,"permission", &permission
+            ,"loa", &loa
+        );
+        if (err || loa < 0) goto OnErrorExit;
+    }
+
+    // auth lives with api handle, permission string with api config
+    if (permission) {
+        introspect[1].type= afb_auth_Permission;
+        introspect[1].text= permission;
+        auth= &introspect[1];
+    }
+    if (loa) {
+        introspect[2].type= afb_auth_LOA;
+        introspect[2].loa= (unsigned)loa;
+        auth= &introspect[2];
+    }
+    if (permission && loa) {
+        introspect[0].type= afb_auth_And;
+        introspect[0].first= &introspect[1];
+        introspect[0].next= &introspect[2];
+        auth= &introspect[0];
+    }
+
+    if (stats && afb_api_add_verb(glue->api.afb, "stats", "per verb counters and latency", GlueStatsCb, glue, auth, 0, 0))
+        return "fail to add api/stats verb";
+    if (profile && afb_api_add_verb(glue->api.afb, "profile", "lua sampling profiler control", GlueProfileCb, glue, auth, 0, 0))
+        return "fail to add api/profile verb";
+    if (trace && afb_api_add_verb(glue->api.afb, "trace", "request tracing control", GlueTraceCb, glue, auth, 0, 0))
+        return "fail to add api/trace verb";
+    return NULL;
+
+OnErrorExit:
+    return "introspection=true|{stats=bool, profile=bool, trace=bool, permission='xxx', loa=n}";
+}
+
 static int GlueApiCreate(lua_State *luaState)
 {
     const char *errorMsg = "syntax: apiadd (config)";
@@ -889,8 +1350,25 @@ static int GlueApiCreate(lua_State *luaState)
     GlueHandleT *binder = LuaBinderPop(luaState);
     assert(binder);
 
+    // verbs array is registered in bulk from lua table, not converted to json
+    int verbsIdx= 0;
+    if (lua_gettop(luaState) == LUA_FIRST_ARG && lua_istable(luaState, LUA_FIRST_ARG)) {
+        lua_getfield(luaState, LUA_FIRST_ARG, "verbs");
+        if (lua_istable(luaState, -1)) {
+            verbsIdx= lua_gettop(luaState);
+            lua_pushnil(luaState);
+            lua_setfield(luaState, LUA_FIRST_ARG, "verbs");
+        } else {
+            lua_pop(luaState, 1);
+        }
+    }
+
     // parse afbApi config
-    configJ = LuaPopArgs(luaState, LUA_FIRST_ARG);
+    configJ = verbsIdx ? LuaPopOneArg(luaState, LUA_FIRST_ARG) : LuaPopArgs(luaState, LUA_FIRST_ARG);
+    if (verbsIdx) {
+        lua_pushvalue(luaState, verbsIdx);
+        lua_setfield(luaState, LUA_FIRST_ARG, "verbs");
+    }
     if (!configJ) goto OnErrorExit;
 
     GlueHandleT *glue = calloc(1, sizeof(GlueHandleT));
@@ -900,9 +1378,22 @@ static int GlueApiCreate(lua_State *luaState)
     glue->api.configJ = configJ;
 
     const char *afbApiUri = NULL;
-    err = wrap_json_unpack(configJ, "{s?s s?s}", "control", &glue->api.ctrlCb, "uri", &afbApiUri);
+    json_object *introJ = NULL;
+    err = wrap_json_unpack(configJ, "{s?s s?s s?o}", "control", &glue->api.ctrlCb, "uri", &afbApiUri, "introspection", &introJ);
     if (err) goto OnErrorExit;
 
+    // imported api verbs are the remote ones
+    if (afbApiUri && verbsIdx) {
+        errorMsg = "apiadd: imported api (uri) cannot declare verbs";
+        goto OnErrorExit;
+    }
+
+    // introspection is handled by lua glue, not by libafb
+    if (introJ) {
+        json_object_get(introJ);
+        json_object_object_del(configJ, "introspection");
+    }
+
     if (afbApiUri)
     {
         // imported shadow api
@@ -916,9 +1407,21 @@ static int GlueApiCreate(lua_State *luaState)
         else
             errorMsg = AfbApiCreate(binder->binder.afb, configJ, &glue->api.afb, NULL, GlueInfoCb, GlueApiVerbCb, GlueApiEventCb, glue);
     }
+    if (introJ) json_object_object_add(configJ, "introspection", introJ);
     if (errorMsg)
         goto OnErrorExit;
 
+    if (glue->api.afb && verbsIdx) {
+        errorMsg = LuaVerbsAdd(luaState, binder, glue, verbsIdx);
+        if (errorMsg) goto OnErrorExit;
+    }
+
+    // optional api/stats|profile|trace control verbs (same vcbdata as api/info)
+    if (glue->api.afb && introJ) {
+        errorMsg = GlueApiIntrospect(glue, introJ);
+        if (errorMsg) goto OnErrorExit;
+    }
+
     lua_pushlightuserdata(luaState, glue);
     return 1;
 
@@ -929,6 +1432,383 @@ OnErrorExit:
     return 1;
 }
 
+static int GlueVerbStats(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: verbstats(api)";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    GlueHandleT *glue = lua_touserdata(luaState, LUA_FIRST_ARG);
+    if (!glue || glue->magic != GLUE_API_MAGIC || !glue->api.afb) goto OnErrorExit;
+
+    json_object *statsJ= LuaStatsJson(glue->api.afb);
+    LuaPushOneArg(luaState, statsJ);
+    json_object_put(statsJ);
+    return 1;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+// budget(api, [verb,] {instructions=count, timeout=ms}) bound lua callbacks execution
+static int GlueBudget(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: budget(api, [verb,] {instructions=count, timeout=ms})";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+    LuaBudgetT *budget;
+    json_object *configJ=NULL;
+    int index= LUA_FIRST_ARG+1;
+
+    GlueHandleT *glue = lua_touserdata(luaState, LUA_FIRST_ARG);
+    if (!glue || glue->magic != GLUE_API_MAGIC || !glue->api.afb) goto OnErrorExit;
+    budget= &glue->api.budget;
+
+    // verb budget overloads api budget
+    if (lua_type(luaState, index) == LUA_TSTRING) {
+        const char *verbname= lua_tostring(luaState, index++);
+        budget= NULL;
+        for (int idx = 0; idx < afb_api_v4_verb_count(glue->api.afb); idx++) {
+            const afb_verb_t *afbVerb = afb_api_v4_verb_at(glue->api.afb, idx);
+            if (!afbVerb) break;
+            if (afbVerb->vcbdata == glue) continue; // control verbs
+
+            AfbVcbDataT *vcbData= afbVerb->vcbdata;
+            if (!vcbData || vcbData->magic != AfbAddVerbs || strcmp(afbVerb->verb, verbname)) continue;
+
+            LuaVerbCtxT *verbCtx= LuaVerbCtxGet(vcbData);
+            if (verbCtx) budget= &verbCtx->budget;
+            break;
+        }
+        if (!budget) {
+            errorMsg= "budget: unknown lua verb";
+            goto OnErrorExit;
+        }
+    }
+
+    int64_t instructions= (int64_t)budget->instructions;
+    int timeout= (int)budget->timeout;
+    configJ= LuaPopOneArg(luaState, index);
+    if (!configJ || wrap_json_unpack(configJ, "{s?I s?i !}", "instructions", &instructions, "timeout", &timeout)) goto OnErrorExit;
+    if (instructions < 0 || timeout < 0) goto OnErrorExit;
+    json_object_put(configJ);
+
+    budget->instructions= (unsigned long)instructions;
+    budget->timeout= (unsigned)timeout;
+    return 0;
+
+OnErrorExit:
+    json_object_put(configJ);
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+// gcconfig({mode=, pause=, stepmul=, stepsize=, idle=ms, idlestep=KB, auto=bool})
+static int GlueGcConfig(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: gcconfig(config)";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    json_object *gcJ= LuaPopOneArg(luaState, LUA_FIRST_ARG);
+    if (!gcJ) goto OnErrorExit;
+    errorMsg= LuaGcConfig(luaState, gcJ);
+    json_object_put(gcJ);
+    if (errorMsg) goto OnErrorExit;
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueGcStats(lua_State *luaState)
+{
+    json_object *gcJ= LuaGcJson(luaState);
+    LuaPushOneArg(luaState, gcJ);
+    json_object_put(gcJ);
+    return 1;
+}
+
+// logconfig({async=true|false, ring=slots})
+static int GlueLogConfig(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: logconfig(config)";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    json_object *logJ= LuaPopOneArg(luaState, LUA_FIRST_ARG);
+    if (!logJ) goto OnErrorExit;
+    errorMsg= LuaLogConfig(logJ);
+    json_object_put(logJ);
+    if (errorMsg) goto OnErrorExit;
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueLogStats(lua_State *luaState)
+{
+    json_object *logJ= LuaLogJson();
+    LuaPushOneArg(luaState, logJ);
+    json_object_put(logJ);
+    return 1;
+}
+
+// bytecode({cache='/var/cache/afb-lua', strip=true|false})
+static int GlueBytecodeConfig(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: bytecode(config)";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    json_object *bytecodeJ= LuaPopOneArg(luaState, LUA_FIRST_ARG);
+    if (!bytecodeJ) goto OnErrorExit;
+    errorMsg= LuaBytecodeConfig(bytecodeJ);
+    json_object_put(bytecodeJ);
+    if (errorMsg) goto OnErrorExit;
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueBytecodeStats(lua_State *luaState)
+{
+    json_object *bytecodeJ= LuaBytecodeJson();
+    LuaPushOneArg(luaState, bytecodeJ);
+    json_object_put(bytecodeJ);
+    return 1;
+}
+
+// loadfile(path) same as lua loadfile but through bytecode cache
+static int GlueLoadFile(lua_State *luaState)
+{
+    const char *path = luaL_checkstring(luaState, LUA_FIRST_ARG);
+
+    if (LuaBytecodeLoad(luaState, path) != LUA_OK) {
+        lua_pushnil(luaState);
+        lua_insert(luaState, -2);
+        return 2; // nil + error message
+    }
+    return 1;
+}
+
+// dofile(path) run chunk and return its results
+static int GlueDoFile(lua_State *luaState)
+{
+    const char *path = luaL_checkstring(luaState, LUA_FIRST_ARG);
+    int base = lua_gettop(luaState);
+
+    if (LuaBytecodeLoad(luaState, path) != LUA_OK) return lua_error(luaState);
+    lua_call(luaState, 0, LUA_MULTRET);
+    return lua_gettop(luaState) - base;
+}
+
+// marshalstats() return global lua<->afb conversion counters
+static int GlueMarshalStats(lua_State *luaState)
+{
+    json_object *marshalJ= LuaMarshalJson(luaMarshal);
+    LuaPushOneArg(luaState, marshalJ);
+    json_object_put(marshalJ);
+    return 1;
+}
+
+// memstats([api]) return api or global lua heap accounting
+static int GlueMemStats(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: memstats([api])";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+    LuaMemStatsT *mem= LuaMemGlobal();
+
+    if (!lua_isnoneornil(luaState, LUA_FIRST_ARG)) {
+        mem= LuaMemOf(lua_touserdata(luaState, LUA_FIRST_ARG));
+        if (!mem) goto OnErrorExit;
+    }
+
+    json_object *memJ= LuaMemJson(mem);
+    LuaPushOneArg(luaState, memJ);
+    json_object_put(memJ);
+    return 1;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+// maxmem([api,] bytes) limit api or global lua heap (0=unlimited)
+static int GlueMaxMem(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: maxmem(bytes)";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+    LuaMemStatsT *mem= LuaMemGlobal();
+    int isNum;
+
+    // per api live bytes are approximate (frees credited to running api), they cannot bound allocations
+    if (lua_islightuserdata(luaState, LUA_FIRST_ARG)) {
+        errorMsg= "maxmem: per api limit is not supported, use global maxmem(bytes)";
+        goto OnErrorExit;
+    }
+
+    lua_Integer maxmem= lua_tointegerx(luaState, LUA_FIRST_ARG, &isNum);
+    if (!isNum || maxmem < 0) goto OnErrorExit;
+    mem->maxmem= (size_t)maxmem;
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+// capturestart(filename, [max]) record lua verb calls as json lines
+static int GlueCaptureStart(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: capturestart(filename, [max])";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    const char *filename= luaL_optstring(luaState, LUA_FIRST_ARG, NULL);
+    lua_Integer max= luaL_optinteger(luaState, LUA_FIRST_ARG+1, 0);
+    if (!filename || max < 0 || LuaCaptureStart(filename, (unsigned long)max)) goto OnErrorExit;
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+// capturestop() return number of captured records
+static int GlueCaptureStop(lua_State *luaState)
+{
+    lua_pushinteger(luaState, (lua_Integer)LuaCaptureStop());
+    return 1;
+}
+
+// tracestart([size]) start recording spans within a ring of size spans
+static int GlueTraceStart(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: tracestart([size])";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+
+    lua_Integer size= luaL_optinteger(luaState, LUA_FIRST_ARG, 0);
+    if (size < 0 || LuaTraceStart((unsigned)size)) goto OnErrorExit;
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueTraceStop(lua_State *luaState)
+{
+    LuaTraceStop ();
+    return 0;
+}
+
+// return chrome trace-event json as a string, or write it to filename
+static int GlueTraceDump(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: tracedump([filename])";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+    const char *filename= luaL_optstring(luaState, LUA_FIRST_ARG, NULL);
+
+    json_object *traceJ= LuaTraceJson();
+    if (filename) {
+        int err= json_object_to_file_ext((char*)filename, traceJ, JSON_C_TO_STRING_PLAIN);
+        json_object_put(traceJ);
+        if (err) {
+            errorMsg= "tracedump: fail to write output file";
+            goto OnErrorExit;
+        }
+        return 0;
+    }
+    lua_pushstring(luaState, json_object_to_json_string_ext(traceJ, JSON_C_TO_STRING_PLAIN));
+    json_object_put(traceJ);
+    return 1;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueProfStart(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: profstart([{count=instructions, period=ms}])";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+    int count=0, period=0;
+
+    if (lua_gettop(luaState) >= LUA_FIRST_ARG) {
+        json_object *configJ= LuaPopOneArg(luaState, LUA_FIRST_ARG);
+        int err= wrap_json_unpack (configJ, "{s?i s?i !}", "count", &count, "period", &period);
+        json_object_put(configJ);
+        if (err) goto OnErrorExit;
+    }
+
+    LuaProfStart (count, period);
+    return 0;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
+static int GlueProfStop(lua_State *luaState)
+{
+    LuaProfStop ();
+    return 0;
+}
+
+// return folded stacks, or write them to filename and return line count
+static int GlueProfDump(lua_State *luaState)
+{
+    const char *errorMsg = "syntax: profdump([filename], [reset])";
+    GlueHandleT *binder = LuaBinderPop(luaState);
+    const char *filename= luaL_optstring(luaState, LUA_FIRST_ARG, NULL);
+    int reset= lua_toboolean(luaState, LUA_FIRST_ARG+1);
+
+    if (filename) {
+        FILE *file= fopen (filename, "w");
+        if (!file) {
+            errorMsg= "profdump: fail to open output file";
+            goto OnErrorExit;
+        }
+        lua_pushinteger(luaState, LuaProfDump(file));
+        fclose (file);
+    } else {
+        char *folded= LuaProfFolded();
+        lua_pushstring(luaState, folded ? folded : "");
+        free (folded);
+    }
+    if (reset) LuaProfReset();
+    return 1;
+
+OnErrorExit:
+    LUA_DBG_ERROR(luaState, binder, errorMsg);
+    lua_pushstring(luaState, errorMsg);
+    lua_error(luaState);
+    return 1;
+}
+
 static int GlueBindingLoad(lua_State *luaState)
 {
     const char *errorMsg = "syntax: binding(config)";
@@ -1029,9 +1909,46 @@ static int GlueBinderConf(lua_State *luaState)
     binder->binder.configJ = LuaPopArgs(luaState, LUA_FIRST_ARG);
     if (!binder->binder.configJ) goto OnErrorExit;
 
+    // garbage collector config is handled by lua glue, not by libafb
+    json_object *gcJ=NULL;
+    if (json_object_object_get_ex(binder->binder.configJ, "gc", &gcJ)) {
+        json_object_get(gcJ);
+        json_object_object_del(binder->binder.configJ, "gc");
+    }
+
+    json_object *loggerJ=NULL;
+    if (json_object_object_get_ex(binder->binder.configJ, "logger", &loggerJ)) {
+        json_object_get(loggerJ);
+        json_object_object_del(binder->binder.configJ, "logger");
+    }
+
+    json_object *bytecodeJ=NULL;
+    if (json_object_object_get_ex(binder->binder.configJ, "bytecode", &bytecodeJ)) {
+        json_object_get(bytecodeJ);
+        json_object_object_del(binder->binder.configJ, "bytecode");
+    }
+
     errorMsg = AfbBinderConfig(binder->binder.configJ, &binder->binder.afb, binder);
     if (errorMsg) goto OnErrorExit;
 
+    if (gcJ) {
+        errorMsg = LuaGcConfig(luaState, gcJ);
+        json_object_put(gcJ);
+        if (errorMsg) goto OnErrorExit;
+    }
+
+    if (loggerJ) {
+        errorMsg = LuaLogConfig(loggerJ);
+        json_object_put(loggerJ);
+        if (errorMsg) goto OnErrorExit;
+    }
+
+    if (bytecodeJ) {
+        errorMsg = LuaBytecodeConfig(bytecodeJ);
+        json_object_put(bytecodeJ);
+        if (errorMsg) goto OnErrorExit;
+    }
+
     // load auxiliary libraries
     luaL_openlibs(luaState);
 
@@ -1080,6 +1997,28 @@ static const luaL_Reg afbFunction[] = {
     {"binder", GlueBinderConf},
     {"apiadd", GlueApiCreate},
     {"verbadd", GlueVerbAdd},
+    {"verbsadd", GlueVerbsAdd},
+    {"verbstats", GlueVerbStats},
+    {"budget", GlueBudget},
+    {"gcconfig", GlueGcConfig},
+    {"gcstats", GlueGcStats},
+    {"logconfig", GlueLogConfig},
+    {"logstats", GlueLogStats},
+    {"bytecode", GlueBytecodeConfig},
+    {"bytecodestats", GlueBytecodeStats},
+    {"loadfile", GlueLoadFile},
+    {"dofile", GlueDoFile},
+    {"memstats", GlueMemStats},
+    {"marshalstats", GlueMarshalStats},
+    {"maxmem", GlueMaxMem},
+    {"capturestart", GlueCaptureStart},
+    {"capturestop", GlueCaptureStop},
+    {"tracestart", GlueTraceStart},
+    {"tracestop", GlueTraceStop},
+    {"tracedump", GlueTraceDump},
+    {"profstart", GlueProfStart},
+    {"profstop", GlueProfStop},
+    {"profdump", GlueProfDump},
     {"config", GlueGetConfig},
     {"binding", GlueBindingLoad},
     {"loopstart", GlueLoopStart},
@@ -1095,9 +2034,14 @@ static const luaL_Reg afbFunction[] = {
     {"evthandler", GlueEvtHandler},
     {"evtnew", GlueEvtNew},
     {"evtpush", GlueEvtPush},
+    {"evtpushmany", GlueEvtPushMany},
     {"timerunref", GlueTimerUnref},
     {"timeraddref", GlueTimerAddref},
     {"timernew", GlueTimerNew},
+    {"timerreset", GlueTimerReset},
+    {"debounce", GlueDebounce},
+    {"throttle", GlueThrottle},
+    {"trigger", GlueTrigger},
     {"callasync", GlueCallAsync},
     {"callsync", GlueCallSync},
     {"setloa", GlueSetLoa},
@@ -1126,6 +2070,15 @@ int luaopen_luaglue(lua_State *luaState)
     // open default Lua exiting lib
     luaL_openlibs(luaState);
 
+    // lazy afb data userdata metatable
+    LuaDataRegister(luaState);
+
+    // lua heap accounting and maxmem
+    LuaMemInstall(luaState);
+
+    // required modules go through bytecode cache when configured
+    LuaBytecodeInstall(luaState);
+
     // add lua glue to interpreter
     luaL_newlibtable(luaState, afbFunction);
     lua_pushlightuserdata(luaState, handle);
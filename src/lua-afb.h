@@ -37,12 +37,31 @@
 #include <lualib.h>
 #include <lauxlib.h>
 
+#include "lua-wheel.h"
+
 typedef struct {
     char *uid;
     char *callback;
     void *userdata;
+    int lazy;  // push replies as afb-data userdata, decoded on demand
 } GlueAsyncCtxT;
 
+// lua heap accounting, attributed to the api running lua code
+typedef struct {
+    long live;              // net allocated bytes
+    unsigned long allocs;   // allocation count
+    unsigned long bytes;    // cumulative allocated bytes
+    unsigned long failures; // allocations refused by maxmem
+    size_t maxmem;          // 0=unlimited
+} LuaMemStatsT;
+
+// per callback execution budget (0=unlimited)
+typedef struct {
+    unsigned long instructions; // lua instructions
+    unsigned timeout;           // wall clock ms
+    unsigned long aborts;       // callbacks aborted
+} LuaBudgetT;
+
 struct LuaBinderHandleS {
     AfbBinderHandleT *afb;
     json_object *configJ;
@@ -60,27 +79,69 @@ struct LuaApiHandleS {
     afb_api_t  afb;
     const char *ctrlCb;
     json_object *configJ;
+    LuaMemStatsT mem;
+    LuaBudgetT budget;
+    struct afb_auth introspect[3]; // stats/profile/trace verbs permission and/or loa
 };
 
 struct LuaRqtHandleS {
     struct LuaApiHandleS *api;
     int replied;
     afb_req_t afb;
+    struct LuaVerbStatsS *stats; // verb stats, closed on reply
+    unsigned long start;         // verb entry time (us)
+    unsigned long allocs;        // lua allocations done for this request
+    unsigned long allocBytes;
+    char *capture;               // pending capture record (capture mode only)
 };
 
+#define LUA_EVT_MAX_PARAMS 8
+
+typedef struct {
+    unsigned count;
+    afb_data_t data[LUA_EVT_MAX_PARAMS];
+} LuaEvtReplayT;
+
 struct LuaEvtHandleS {
     afb_event_t afb;
     afb_api_t apiv4;
     char *pattern;
     json_object *configJ;
     GlueAsyncCtxT async;
+    unsigned coalesce;  // flush window in ms (0=push immediately)
+    int batch;          // coalesce mode latest|batch
+    unsigned npending;
+    afb_data_t pending[LUA_EVT_MAX_PARAMS];
+    json_object *batchJ;
+    LuaWheelNodeT node;
+    unsigned replay;    // replay ring size (0=no replay)
+    unsigned rhead;     // next ring slot
+    unsigned rcount;    // used ring slots
+    LuaEvtReplayT *ring;
+    int delta;          // push merge-patch against previous state
+    unsigned snapshot;  // full state every n push
+    unsigned seq;
+    json_object *stateJ;
 };
 
+typedef enum {
+    LUA_TIMER_PERIODIC=0,
+    LUA_TIMER_DEBOUNCE,
+    LUA_TIMER_THROTTLE,
+} LuaTimerModeE;
+
 struct LuaTimerHandleS {
     afb_timer_t afb;
     afb_api_t apiv4;
     json_object *configJ;
     GlueAsyncCtxT async;
+    unsigned period;
+    unsigned count;
+    int wheel;          // timer shares the global timer wheel
+    LuaWheelNodeT node;
+    LuaTimerModeE mode;
+    int triggers;       // debounce/throttle collapsed trigger count
+    int valueRef;       // debounce/throttle last trigger value (registry)
 };
 
 struct LuaPostHandleS {
@@ -108,6 +169,8 @@ typedef struct {
     int magic;
     GlueHandleT *glue;
     GlueAsyncCtxT async;
+    unsigned long span;     // trace span issuing the call
+    unsigned long issued;   // trace issue time (us)
 } GlueCallHandleT;
 
 #define LUA_FIRST_ARG 1 // 1st argument
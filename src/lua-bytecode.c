@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Bytecode cache: scripts and required modules are compiled once and their
+ * lua_dump bytecode is stored in a cache directory, keyed by source path,
+ * mtime, size and content hash. Following starts load bytecode with
+ * lua_load instead of parsing source. Debug info may optionally be stripped
+ * (smaller/faster, but tracebacks lose line numbers). Any cache problem
+ * falls back to source.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <wrap-json.h>
+
+#include "lua-afb.h"
+#include "lua-stats.h"
+#include "lua-bytecode.h"
+
+#define LUA_BYTECODE_MAGIC "AFBLUAC"
+
+typedef struct {
+    char magic[8];
+    int32_t version;    // LUA_VERSION_NUM
+    int32_t strip;
+    int64_t mtime;      // source mtime (ns)
+    int64_t size;       // source size
+    uint64_t hash;      // source content hash
+} LuaBytecodeHeaderT;
+
+static struct {
+    char *cache;        // cache directory (NULL=disabled)
+    int strip;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long writes;
+    unsigned long failures;
+    unsigned long usec; // time spent loading chunks
+} bytecode;
+
+// FNV-1a 64 bits
+static uint64_t LuaBytecodeHash (const char *data, size_t len) {
+    uint64_t hash= 14695981039346656037ULL;
+    for (size_t idx=0; idx < len; idx++) {
+        hash ^= (unsigned char)data[idx];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// lua_load does not verify bytecode, cache entries must only be writable by binder user
+static int LuaBytecodeTrusted (const struct stat *status) {
+    return (status->st_uid == geteuid() && !(status->st_mode & (S_IWGRP | S_IWOTH)));
+}
+
+// cache files are opened without following symlinks and checked for ownership
+static char *LuaBytecodeReadFile (const char *path, size_t *size, int cached) {
+    char *buffer=NULL;
+    FILE *file=NULL;
+    struct stat status;
+
+    int fd= open (path, O_RDONLY | O_CLOEXEC | (cached ? O_NOFOLLOW : 0));
+    if (fd < 0) goto OnErrorExit;
+    if (fstat (fd, &status) || !S_ISREG (status.st_mode)) goto OnErrorExit;
+    if (cached && !LuaBytecodeTrusted (&status)) goto OnErrorExit;
+
+    file= fdopen (fd, "rb");
+    if (!file) goto OnErrorExit;
+    fd= -1;
+
+    buffer= malloc ((size_t)status.st_size +1);
+    if (!buffer) goto OnErrorExit;
+    if (fread (buffer, 1, (size_t)status.st_size, file) != (size_t)status.st_size) goto OnErrorExit;
+    buffer[status.st_size]= '\0';
+    *size= (size_t)status.st_size;
+    fclose (file);
+    return buffer;
+
+OnErrorExit:
+    free (buffer);
+    if (file) fclose (file);
+    if (fd >= 0) close (fd);
+    return NULL;
+}
+
+// cache directory is created private, an existing one should be owned by binder user and not shared
+static int LuaBytecodeCacheDir (const char *cache) {
+    struct stat status;
+
+    if (mkdir (cache, 0700) && errno != EEXIST) goto OnErrorExit;
+    if (lstat (cache, &status) || !S_ISDIR (status.st_mode)) goto OnErrorExit;
+    if (!LuaBytecodeTrusted (&status) || access (cache, W_OK)) goto OnErrorExit;
+
+    free (bytecode.cache);
+    bytecode.cache= strdup (cache);
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
+
+static int LuaBytecodeWriter (lua_State *luaState, const void *data, size_t size, void *userdata) {
+    return (fwrite (data, 1, size, (FILE*)userdata) != size);
+}
+
+// write to a private temporary file then rename, concurrent binders never see partial bytecode
+static void LuaBytecodeStore (lua_State *luaState, const char *cachePath, const LuaBytecodeHeaderT *header) {
+    char tmpPath[PATH_MAX];
+    FILE *file= NULL;
+
+    snprintf (tmpPath, sizeof(tmpPath), "%s/.luac-XXXXXX", bytecode.cache);
+    int fd= mkstemp (tmpPath); // O_EXCL, mode 0600
+    if (fd < 0) goto OnErrorExit;
+    file= fdopen (fd, "wb");
+    if (!file) {
+        close (fd);
+        goto OnErrorExit;
+    }
+
+    int err= (fwrite (header, sizeof(LuaBytecodeHeaderT), 1, file) != 1);
+    if (!err) err= lua_dump (luaState, LuaBytecodeWriter, file, bytecode.strip);
+    if (fclose (file)) err= 1;
+    if (err || rename (tmpPath, cachePath)) goto OnErrorExit;
+
+    bytecode.writes++;
+    return;
+
+OnErrorExit:
+    if (fd >= 0) unlink (tmpPath);
+    bytecode.failures++;
+}
+
+// cached bytecode is used only when header matches current source
+static int LuaBytecodeCached (lua_State *luaState, const char *cachePath, const char *chunkname, const LuaBytecodeHeaderT *header) {
+    LuaBytecodeHeaderT cached;
+    size_t size;
+    int status= -1;
+
+    char *buffer= LuaBytecodeReadFile (cachePath, &size, 1);
+    if (!buffer || size < sizeof(LuaBytecodeHeaderT)) goto OnExit;
+
+    memcpy (&cached, buffer, sizeof(LuaBytecodeHeaderT));
+    if (memcmp (&cached, header, sizeof(LuaBytecodeHeaderT))) goto OnExit;
+
+    // lua_load still checks bytecode format (lua build, number sizes)
+    status= luaL_loadbufferx (luaState, buffer + sizeof(LuaBytecodeHeaderT), size - sizeof(LuaBytecodeHeaderT), chunkname, "b");
+    if (status != LUA_OK) {
+        lua_pop (luaState, 1);
+        bytecode.failures++;
+    }
+
+OnExit:
+    free (buffer);
+    return status;
+}
+
+// push compiled chunk (or error message) as luaL_loadfile does
+int LuaBytecodeLoad (lua_State *luaState, const char *path) {
+    char realPath[PATH_MAX], cachePath[PATH_MAX], chunkname[PATH_MAX+1];
+    LuaBytecodeHeaderT header;
+    struct stat status;
+    size_t size;
+    int err;
+
+    unsigned long start= LuaStatsNow();
+    if (!bytecode.cache || !realpath (path, realPath) || stat (realPath, &status)) {
+        err= luaL_loadfile (luaState, path);
+        goto OnExit;
+    }
+    snprintf (chunkname, sizeof(chunkname), "@%s", path);
+
+    char *source= LuaBytecodeReadFile (realPath, &size, 0);
+    if (!source) {
+        err= luaL_loadfile (luaState, path);
+        goto OnExit;
+    }
+
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, LUA_BYTECODE_MAGIC, sizeof(header.magic));
+    header.version= LUA_VERSION_NUM;
+    header.strip= bytecode.strip;
+    header.mtime= (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+    header.size= (int64_t)size;
+    header.hash= LuaBytecodeHash (source, size);
+    snprintf (cachePath, sizeof(cachePath), "%s/%016llx.luac", bytecode.cache, (unsigned long long)LuaBytecodeHash (realPath, strlen (realPath)));
+
+    if (LuaBytecodeCached (luaState, cachePath, chunkname, &header) == LUA_OK) {
+        bytecode.hits++;
+        free (source);
+        err= LUA_OK;
+        goto OnExit;
+    }
+
+    // skip '#!' first line as luaL_loadfile does, keeping line numbers
+    const char *text= source;
+    if (size && text[0] == '#') text= strchr (text, '\n') ?: &source[size];
+
+    bytecode.misses++;
+    err= luaL_loadbufferx (luaState, text, size - (size_t)(text - source), chunkname, "t");
+    if (err == LUA_OK) LuaBytecodeStore (luaState, cachePath, &header);
+    free (source);
+
+OnExit:
+    bytecode.usec += LuaStatsNow() - start;
+    return err;
+}
+
+// package.searchers entry, same lookup as lua file searcher (package.path)
+static int LuaBytecodeSearcher (lua_State *luaState) {
+    const char *name= luaL_checkstring (luaState, 1);
+
+    if (!bytecode.cache) return 0; // let default searchers do the job
+
+    lua_getglobal (luaState, "package");
+    lua_getfield (luaState, -1, "searchpath");
+    lua_pushstring (luaState, name);
+    lua_getfield (luaState, -3, "path");
+    lua_call (luaState, 2, 2);
+    if (lua_isnil (luaState, -2)) return 1; // error message from searchpath
+
+    const char *filename= lua_tostring (luaState, -2);
+    if (LuaBytecodeLoad (luaState, filename) != LUA_OK) {
+        return luaL_error (luaState, "error loading module '%s' from file '%s':\n\t%s", name, filename, lua_tostring (luaState, -1));
+    }
+    lua_pushstring (luaState, filename);
+    return 2;
+}
+
+// insert cache searcher before default lua file searcher (after preload one)
+void LuaBytecodeInstall (lua_State *luaState) {
+    const char *cache= getenv (LUA_BYTECODE_ENV);
+    if (cache && !bytecode.cache && LuaBytecodeCacheDir (cache)) {
+        ERROR ("%s=%s ignored: cache should be a directory owned by binder user and not writable by group/other", LUA_BYTECODE_ENV, cache);
+    }
+
+    lua_getglobal (luaState, "package");
+    lua_getfield (luaState, -1, "searchers");
+    if (!lua_istable (luaState, -1)) goto OnExit;
+
+    for (lua_Integer idx= (lua_Integer)luaL_len (luaState, -1); idx >= 2; idx--) {
+        lua_rawgeti (luaState, -1, idx);
+        lua_rawseti (luaState, -2, idx+1);
+    }
+    lua_pushcfunction (luaState, LuaBytecodeSearcher);
+    lua_rawseti (luaState, -2, 2);
+
+OnExit:
+    lua_pop (luaState, 2);
+}
+
+// bytecode={cache='/var/cache/lua', strip=true|false}, cache=false disables
+const char *LuaBytecodeConfig (json_object *configJ) {
+    json_object *cacheJ=NULL;
+    int strip= bytecode.strip;
+
+    int err= wrap_json_unpack (configJ, "{s?o s?b !}", "cache", &cacheJ, "strip", &strip);
+    if (err) goto OnErrorExit;
+
+    if (cacheJ) {
+        if (json_object_is_type (cacheJ, json_type_string)) {
+            if (LuaBytecodeCacheDir (json_object_get_string (cacheJ))) goto OnErrorExit;
+        } else if (json_object_is_type (cacheJ, json_type_boolean) && !json_object_get_boolean (cacheJ)) {
+            free (bytecode.cache);
+            bytecode.cache= NULL;
+        } else goto OnErrorExit;
+    }
+    bytecode.strip= strip;
+    return NULL;
+
+OnErrorExit:
+    return "bytecode={cache='/private/dir'|false, strip=true|false} (dir owned by binder user, not writable by group/other)";
+}
+
+json_object *LuaBytecodeJson (void) {
+    json_object *bytecodeJ;
+    wrap_json_pack (&bytecodeJ, "{ss* sb sI sI sI sI sI}"
+        ,"cache", bytecode.cache
+        ,"strip", bytecode.strip
+        ,"hits", (int64_t)bytecode.hits
+        ,"misses", (int64_t)bytecode.misses
+        ,"writes", (int64_t)bytecode.writes
+        ,"failures", (int64_t)bytecode.failures
+        ,"usec", (int64_t)bytecode.usec
+    );
+    return bytecodeJ;
+}
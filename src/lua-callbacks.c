@@ -24,6 +24,7 @@
 #include <lua.h>
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <sys/time.h>
 #include <stdarg.h>
@@ -35,26 +36,59 @@
 #include "lua-afb.h"
 #include "lua-utils.h"
 #include "lua-callbacks.h"
+#include "lua-pool.h"
+#include "lua-stats.h"
+#include "lua-hook.h"
+#include "lua-trace.h"
+#include "lua-capture.h"
+#include "lua-verbs.h"
 
 void GlueTimerClear(GlueHandleT *glue) {
 
-    afb_timer_unref (glue->timer.afb);
+    if (!glue->timer.wheel) afb_timer_unref (glue->timer.afb);
     json_object_put(glue->timer.configJ);
     glue->usage--;
 
     // free timer luaState and handle
     if (glue->usage <= 0) {
-       lua_settop(glue->luaState,0);
+       if (glue->timer.wheel) LuaWheelDisarm (&glue->timer.node);
+       else lua_settop(glue->luaState,0);
+       if (glue->timer.mode != LUA_TIMER_PERIODIC && glue->timer.valueRef != LUA_NOREF)
+           luaL_unref(glue->luaState, LUA_REGISTRYINDEX, glue->timer.valueRef);
        json_object_put(glue->timer.configJ);
        free(glue);
     }
 }
 
 
+// api budget also applies to timers, events and async callbacks
+static LuaBudgetT *LuaBudgetOf (GlueHandleT *glue) {
+    GlueHandleT *api= GlueGetApiHandle(glue);
+    if (!api) return NULL;
+    return &api->api.budget;
+}
+
+// timer callbacks may release their own handle, errors are logged from values saved before pcall
+static void GluePcallError (lua_State *luaState, GlueHandleT *logger, const char *callback) {
+    if (logger) {
+        LUA_DBG_ERROR(luaState, logger, callback);
+    } else {
+        ERROR ("%s error=[%s]", callback, lua_tostring(luaState, -1));
+    }
+}
+
 static void GluePcallFunc (GlueHandleT *glue, GlueAsyncCtxT *async, const char *label, int status, unsigned nreplies, afb_data_t const replies[]) {
 //static void GluePcallFunc (void *userdata, int status, unsigned nreplies, afb_data_t const replies[]) {
     const char *errorMsg = "internal-error";
     int err, count;
+    LuaHookCtxT hookCtx;
+    lua_State *luaState= glue->luaState;
+    GlueHandleT *logger= glue;
+    char callback[128];
+
+    // timer callback may release its handle (and its configJ holding callback name)
+    if (glue->magic == GLUE_TIMER_MAGIC) logger= GlueGetApiHandle(glue);
+    snprintf (callback, sizeof(callback), "%s", async->callback ? async->callback : "");
 
     // subcall was refused
     if (AFB_IS_BINDER_ERRNO(status)) {
@@ -74,16 +108,19 @@ static void GluePcallFunc (GlueHandleT *glue, GlueAsyncCtxT *async, const char *
     else lua_pushnil(glue->luaState);
 
     // retreive subcall response and build LUA response
-    errorMsg= LuaPushAfbReply (glue->luaState, nreplies, replies, &count);
-    if (errorMsg) goto OnErrorExit;
-
-    // effectively exec LUA script code
-    err = lua_pcall(glue->luaState, count+3, LUA_MULTRET, 0);
-    if (err) {
-        errorMsg= async->callback;
-        goto OnErrorExit;
+    if (async->lazy) {
+        count= LuaPushAfbData (glue->luaState, nreplies, replies);
+    } else {
+        errorMsg= LuaPushAfbReply (glue->luaState, nreplies, replies, &count);
+        if (errorMsg) goto OnErrorExit;
     }
 
+    // effectively exec LUA script code
+    LuaHookEnter (&hookCtx, luaState, glue);
+    LuaHookBudget (LuaBudgetOf (glue));
+    err = lua_pcall(luaState, count+3, LUA_MULTRET, 0);
+    LuaHookLeave (&hookCtx);
+    if (err) GluePcallError (luaState, logger, callback);
     return;
 
 OnErrorExit:
@@ -125,11 +162,14 @@ void GlueApiEventCb (void *userdata, const char *label, unsigned nparams, afb_da
         // create an async structure to use gluePcallFunc and extract callbackR from json userdata
         GlueAsyncCtxT *async= calloc (1, sizeof(GlueAsyncCtxT));
         async->callback=  (char*)json_object_get_string (callbackJ);
+        async->lazy= 1; // handlers only decode payload when they read it
         vcbData->callback = (void*)async;
     }
 
-    //GluePcallFunc (glue, (GlueAsyncCtxT*)vcbData->callback, label, 0, nparams, params);
-    GluePcallFunc (glue, (GlueAsyncCtxT*)vcbData->callback, label, 0, 0, NULL);
+    LuaSpanT span;
+    LuaTraceBegin (&span, "event", NULL, label, 0, 0);
+    GluePcallFunc (glue, (GlueAsyncCtxT*)vcbData->callback, label, 0, nparams, params);
+    LuaTraceEnd (&span);
     return;
 
 OnErrorExit:
@@ -140,48 +180,130 @@ OnErrorExit:
 void GlueEventCb (void *userdata, const char *label, unsigned nparams, afb_data_x4_t const params[], afb_api_t api) {
     GlueHandleT *glue= (GlueHandleT*) userdata;
     assert (glue->magic == GLUE_EVT_MAGIC);
+
+    LuaSpanT span;
+    LuaTraceBegin (&span, "event", NULL, label, 0, 0);
     GluePcallFunc (glue, &glue->event.async, label, 0, nparams, params);
+    LuaTraceEnd (&span);
 }
 
 void GlueTimerCb (afb_timer_x4_t timer, void *userdata, int decount) {
    GlueHandleT *glue= (GlueHandleT*) userdata;
    assert (glue->magic == GLUE_TIMER_MAGIC);
+
+   LuaSpanT span;
+   LuaTraceBegin (&span, "timer", NULL, glue->timer.async.uid, 0, 0);
    GluePcallFunc (glue, &glue->timer.async, NULL, decount, 0, NULL);
+   LuaTraceEnd (&span);
+}
+
+// debounce/throttle lua callback(handle, count, userdata, value)
+void GlueTriggerRun (GlueHandleT *glue, lua_State *luaState) {
+    int stack= lua_gettop(luaState);
+    const char *callback= glue->timer.async.callback; // interned
+    GlueHandleT *logger= GlueGetApiHandle(glue);
+
+    lua_getglobal(luaState, glue->timer.async.callback);
+    lua_pushlightuserdata(luaState, glue);
+    lua_pushinteger(luaState, glue->timer.triggers);
+
+    if (glue->timer.async.userdata) lua_pushlightuserdata(luaState, glue->timer.async.userdata);
+    else lua_pushnil(luaState);
+
+    // last trigger value is released as soon as pushed
+    if (glue->timer.valueRef != LUA_NOREF) {
+        lua_rawgeti(luaState, LUA_REGISTRYINDEX, glue->timer.valueRef);
+        luaL_unref(luaState, LUA_REGISTRYINDEX, glue->timer.valueRef);
+        glue->timer.valueRef= LUA_NOREF;
+    } else {
+        lua_pushnil(luaState);
+    }
+    glue->timer.triggers= 0;
+
+    LuaHookCtxT hookCtx;
+    LuaHookEnter (&hookCtx, luaState, glue);
+    LuaHookBudget (LuaBudgetOf (glue));
+    int err= lua_pcall(luaState, 4, 0, 0);
+    LuaHookLeave (&hookCtx);
+    if (err) GluePcallError (luaState, logger, callback);
+    lua_settop(luaState, stack);
+}
+
+// wheel timers share one interpretor thread, restore its stack after each run
+void GlueWheelCb (LuaWheelNodeT *node, unsigned decount) {
+   GlueHandleT *glue= (GlueHandleT*) node->context;
+   assert (glue->magic == GLUE_TIMER_MAGIC);
+
+   LuaSpanT span;
+   LuaTraceBegin (&span, "timer", NULL, glue->timer.async.uid, 0, 0);
+
+   switch (glue->timer.mode) {
+       case LUA_TIMER_DEBOUNCE:
+           GlueTriggerRun (glue, glue->luaState);
+           break;
+
+       case LUA_TIMER_THROTTLE:
+           // window closes silently when no trigger happened meanwhile
+           if (glue->timer.triggers) {
+               LuaWheelArm (&glue->timer.node, glue->timer.period, 1);
+               GlueTriggerRun (glue, glue->luaState);
+           }
+           break;
+
+       default: {
+           // callback may timerunref its own handle, only locals are used after it
+           lua_State *luaState= glue->luaState;
+           int stack= lua_gettop(luaState);
+           GluePcallFunc (glue, &glue->timer.async, NULL, (int)decount, 0, NULL);
+           lua_settop(luaState, stack);
+       }
+   }
+   LuaTraceEnd (&span); // span only holds interned names
 }
 
 void GlueJobPostCb (int signum, void *userdata) {
     GlueCallHandleT *handle= (GlueCallHandleT*) userdata;
     assert (handle->magic == GLUE_POST_MAGIC);
     if (!signum) GluePcallFunc (handle->glue, &handle->async, NULL, signum, 0, NULL);
-    free (handle->async.uid);
-    free (handle);
+    LuaPoolPut (&glueCallPool, handle);
 }
 
 void GlueApiSubcallCb (void *userdata, int status, unsigned nreplies, afb_data_t const replies[], afb_api_t api) {
     GlueCallHandleT *handle= (GlueCallHandleT*) userdata;
     assert (handle->magic == GLUE_CALL_MAGIC);
+
+    LuaSpanT span;
+    LuaTraceBegin (&span, "callasync", NULL, handle->async.uid, handle->span, handle->issued);
     GluePcallFunc (handle->glue, &handle->async, NULL, status, nreplies, replies);
-    free (handle->async.uid);
-    free (handle->async.callback);
-    free (handle);
+    LuaTraceEnd (&span);
+    LuaPoolPut (&glueCallPool, handle);
 }
 
 void GlueRqtSubcallCb (void *userdata, int status, unsigned nreplies, afb_data_t const replies[], afb_req_t req) {
     GlueCallHandleT *handle= (GlueCallHandleT*) userdata;
     assert (handle->magic == GLUE_CALL_MAGIC);
+
+    LuaSpanT span;
+    LuaTraceBegin (&span, "callasync", NULL, handle->async.uid, handle->span, handle->issued);
     GluePcallFunc (handle->glue, &handle->async, NULL, status, nreplies, replies);
-    free (handle->async.uid);
-    free (handle->async.callback);
-    free (handle);
+    LuaTraceEnd (&span);
+    LuaPoolPut (&glueCallPool, handle);
 }
 
 void GlueApiVerbCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[])
 {
     const char *errorMsg = NULL;
-    int err, count;
+    int err, count, expired, errorStatus= -1;
     GlueHandleT *glue = GlueRqtNew(afbRqt);
     lua_State *luaState= glue->luaState;
     json_object *argsJ[nparams];
+    LuaVerbCtxT *verbCtx;
+    unsigned long tstamp, now;
+    LuaHookCtxT hookCtx;
+    LuaMarshalT marshalMark;
+    LuaSpanT span;
+
+    LuaTraceBegin (&span, "verb", afb_api_name(afb_req_get_api(afbRqt)), afb_req_get_called_verb(afbRqt), 0, 0);
 
     // on first call we compile configJ to boost following py api/verb calls
     AfbVcbDataT *vcbData= afb_req_get_vcbdata(afbRqt);
@@ -191,15 +313,13 @@ void GlueApiVerbCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]
     }
 
     // on first call we need to retreive original callback object from configJ
-    if (!vcbData->callback)
-    {
-        json_object *funcJ=json_object_object_get(vcbData->configJ, "callback");
-        if (!funcJ) {
-            errorMsg = "(hoops) not callback defined";
-            goto OnErrorExit;
-        }
-        vcbData->callback= (void*)json_object_get_string(funcJ);
+    verbCtx= LuaVerbCtxGet (vcbData);
+    if (!verbCtx) {
+        errorMsg = "(hoops) not callback defined";
+        goto OnErrorExit;
     }
+    LuaStatsStart (glue, &verbCtx->stats);
+    tstamp= glue->rqt.start;
 
     // retreive input arguments and convert them to json
     for (int idx = 0; idx < nparams; idx++)
@@ -214,13 +334,15 @@ void GlueApiVerbCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]
         argsJ[idx] = afb_data_ro_pointer(arg);
         afb_data_unref(arg);
     }
+    if (LuaCaptureActive()) LuaCaptureBegin (glue, afb_api_name(afb_req_get_api(afbRqt)), afb_req_get_called_verb(afbRqt), nparams, argsJ);
 
     // define lua api/verb function
     int stack = lua_gettop(luaState);
-    lua_getglobal(luaState, (char*)vcbData->callback);
+    lua_getglobal(luaState, verbCtx->callback);
     lua_pushlightuserdata(luaState, glue);
 
     // push query list argument to lua func
+    marshalMark= luaMarshal[LUA_MARSHAL_TOLUA];
     for (count = 0; count < nparams; count++)
     {
         err = LuaPushOneArg(luaState, argsJ[count]);
@@ -230,12 +352,29 @@ void GlueApiVerbCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]
             goto OnErrorExit;
         }
     }
+    LuaMarshalAdd (&verbCtx->stats.marshal[LUA_MARSHAL_TOLUA], &marshalMark, LUA_MARSHAL_TOLUA);
+    now= LuaStatsNow();
+    LuaHistoAdd (&verbCtx->stats.histo[LUA_STAT_MARSHAL], now - tstamp);
+    tstamp= now;
 
     // effectively exec LUA script code
+    // verb budget overloads api one
+    LuaHookEnter (&hookCtx, luaState, glue);
+    if (verbCtx->budget.instructions || verbCtx->budget.timeout) LuaHookBudget (&verbCtx->budget);
+    else LuaHookBudget (&glue->rqt.api->budget);
     err = lua_pcall(luaState, count + 1, LUA_MULTRET, 0);
+    expired= LuaHookExpired();
+    LuaHookLeave (&hookCtx);
+    now= LuaStatsNow();
+    LuaHistoAdd (&verbCtx->stats.histo[LUA_STAT_EXEC], now - tstamp);
+    tstamp= now;
     if (err)
     {
         LUA_DBG_ERROR(luaState, glue, "GlueApiVerbCb");
+        if (expired) {
+            errorMsg= "execution budget exceeded";
+            errorStatus= -ETIMEDOUT;
+        }
         goto OnErrorExit;
     }
     else
@@ -253,21 +392,24 @@ void GlueApiVerbCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]
                 goto OnErrorExit;
             }
 
+            marshalMark= luaMarshal[LUA_MARSHAL_FROMLUA];
             for (int idx = count - 1; idx > 0; idx--)
             {
-                json_object *responseJ;
-                responseJ = LuaPopOneArg(luaState, -1 * idx);
-                if (!responseJ)
+                if (LuaPopOneData(luaState, -1 * idx, &reply[index]))
                 {
                     errorMsg = "(hoops) invalid Lua internal response";
                     goto OnErrorExit;
                 }
-                afb_create_data_raw(&reply[index++], AFB_PREDEFINED_TYPE_JSON_C, responseJ, 0, (void *)json_object_put, responseJ);
+                index++;
             }
+            LuaMarshalAdd (&verbCtx->stats.marshal[LUA_MARSHAL_FROMLUA], &marshalMark, LUA_MARSHAL_FROMLUA);
+            LuaHistoAdd (&verbCtx->stats.histo[LUA_STAT_REPLY], LuaStatsNow() - tstamp);
+
             // afb response should be provided by lua api/verb function
             GlueReply(glue, status, index, reply);
         }
     }
+    LuaTraceEnd (&span);
     return;
 
 OnErrorExit:
@@ -276,8 +418,9 @@ OnErrorExit:
         json_object *errorJ = LuaJsonDbg(luaState, errorMsg);
         GLUE_AFB_WARNING(glue, "verb=[%s] lua=%s", afb_req_get_called_verb(afbRqt), json_object_get_string(errorJ));
         afb_create_data_raw(&reply, AFB_PREDEFINED_TYPE_JSON_C, errorJ, 0, (void *)json_object_put, errorJ);
-        GlueReply(glue, -1, 1, &reply);
+        GlueReply(glue, errorStatus, 1, &reply);
     }
+    LuaTraceEnd (&span);
 }
 
 // automatic generation of api/info introspection verb
@@ -301,19 +444,8 @@ void GlueInfoCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[])
         ,"info", infoJ
     );
 
-    // extract info from each verb
-    json_object *verbsJ = json_object_new_array();
-    for (int idx = 0; idx < afb_api_v4_verb_count(apiv4); idx++)
-    {
-        const afb_verb_t *afbVerb = afb_api_v4_verb_at(apiv4, idx);
-        if (!afbVerb) break;
-        if (afbVerb->vcbdata != glue) {
-            AfbVcbDataT *vcbData= afbVerb->vcbdata;
-            if (vcbData->magic != AfbAddVerbs) continue;
-            json_object_array_add(verbsJ, vcbData->configJ);
-            json_object_get(verbsJ);
-        }
-    }
+    // extract info from each verb (bulk verbs metadata is built on first request)
+    json_object *verbsJ = LuaVerbsJson(apiv4);
     // info devtool require a group array
     json_object *groupsJ;
     wrap_json_pack(&groupsJ, "[{so}]", "verbs", verbsJ);
@@ -345,7 +477,10 @@ int GlueStartupCb(void* callback, void *userdata)
         else lua_pushnil(handle->luaState);
 
         // effectively exec LUA script code
+        LuaHookCtxT hookCtx;
+        LuaHookEnter (&hookCtx, handle->luaState, handle);
         err = lua_pcall(handle->luaState, 2, LUA_MULTRET, 0);
+        LuaHookLeave (&hookCtx);
         if (err)
             goto OnErrorExit;
 
@@ -417,7 +552,10 @@ int GlueCtrlCb(afb_api_t apiv4, afb_ctlid_t ctlid, afb_ctlarg_t ctlarg, void *us
 
         // effectively exec LUA script code
         GLUE_AFB_NOTICE(glue,"GlueCtrlCb: func=[%s] state=[%s]", glue->api.ctrlCb, state);
+        LuaHookCtxT hookCtx;
+        LuaHookEnter (&hookCtx, glue->luaState, glue);
         err = lua_pcall(glue->luaState, 2, LUA_MULTRET, 0);
+        LuaHookLeave (&hookCtx);
         if (err) goto OnErrorExit;
 
         // check number of returned arguments
@@ -42,6 +42,8 @@ int  GlueCtrlCb(afb_api_t apiv4, afb_ctlid_t ctlid, afb_ctlarg_t ctlarg, void *u
 void GlueApiVerbCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]);
 void GlueInfoCb(afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]);
 void GlueTimerCb (afb_timer_x4_t timer, void *userdata, int decount);
+void GlueWheelCb (LuaWheelNodeT *node, unsigned decount);
+void GlueTriggerRun (GlueHandleT *glue, lua_State *luaState);
 int GlueStartupCb(void *callback, void *userdata);
 void GlueTimerClear(GlueHandleT *glue);
 
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Verb traffic capture: every lua verb call is recorded as one JSON line
+ * {t, api, verb, params, status, usec, reply} where t is arrival time (us)
+ * relative to capture start, usec verb duration up to reply and reply the
+ * reply size in bytes. Files are replayed by bench-replay.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include <wrap-json.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-stats.h"
+#include "lua-capture.h"
+
+static struct {
+    FILE *file;
+    char *path;
+    pthread_mutex_t lock;
+    unsigned long start;    // capture start (us)
+    unsigned long max;      // stop after max records (0=unlimited)
+    unsigned long count;
+    unsigned long pending;  // requests captured but not replied yet
+} capture= {.lock= PTHREAD_MUTEX_INITIALIZER};
+
+int LuaCaptureActive (void) {
+    return (capture.file != NULL);
+}
+
+// records are appended, a capture may be resumed on same file
+int LuaCaptureStart (const char *path, unsigned long max) {
+    FILE *file= fopen (path, "a");
+    if (!file) goto OnErrorExit;
+
+    pthread_mutex_lock (&capture.lock);
+    if (capture.file) fclose (capture.file);
+    free (capture.path);
+    capture.file= file;
+    capture.path= strdup (path);
+    capture.start= LuaStatsNow();
+    capture.max= max;
+    capture.count= 0;
+    pthread_mutex_unlock (&capture.lock);
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
+
+unsigned long LuaCaptureStop (void) {
+    pthread_mutex_lock (&capture.lock);
+    if (capture.file) fclose (capture.file);
+    capture.file= NULL;
+    unsigned long count= capture.count;
+    pthread_mutex_unlock (&capture.lock);
+    return count;
+}
+
+// build record head at verb entry, request may be gone when released without reply
+void LuaCaptureBegin (GlueHandleT *glue, const char *api, const char *verb, unsigned nparams, json_object *argsJ[]) {
+    json_object *headJ, *paramsJ= json_object_new_array();
+
+    assert (glue->magic == GLUE_RQT_MAGIC);
+    for (unsigned idx=0; idx < nparams; idx++) {
+        json_object_array_add (paramsJ, json_object_get (argsJ[idx]));
+    }
+    wrap_json_pack (&headJ, "{sI ss ss so}"
+        ,"t", (int64_t)(glue->rqt.start - capture.start)
+        ,"api", api
+        ,"verb", verb
+        ,"params", paramsJ
+    );
+    if (!headJ) return;
+
+    // keep record open, reply fields are appended on reply
+    size_t length;
+    const char *text= json_object_to_json_string_length (headJ, JSON_C_TO_STRING_PLAIN, &length);
+    char *record= strndup (text, length -1);
+    json_object_put (headJ);
+    if (!record) return;
+
+    glue->rqt.capture= record;
+    __atomic_add_fetch (&capture.pending, 1, __ATOMIC_RELAXED);
+}
+
+static size_t LuaCaptureSize (unsigned nreplies, afb_data_t const replies[]) {
+    size_t size=0;
+
+    for (unsigned idx=0; idx < nreplies; idx++) {
+        if (!replies[idx]) continue;
+        if (afb_typeid (afb_data_type (replies[idx])) == Afb_Typeid_Predefined_Json_C) {
+            json_object *valueJ= (json_object*)afb_data_ro_pointer (replies[idx]);
+            size_t length=0;
+            if (valueJ) json_object_to_json_string_length (valueJ, JSON_C_TO_STRING_PLAIN, &length);
+            size += length;
+        } else {
+            size += afb_data_size (replies[idx]);
+        }
+    }
+    return size;
+}
+
+// close record on reply (or on release without reply with status=-1)
+void LuaCaptureDone (GlueHandleT *glue, int status, unsigned nreplies, afb_data_t const replies[]) {
+    char *record= glue->rqt.capture;
+    if (!record) return;
+
+    glue->rqt.capture= NULL;
+    __atomic_sub_fetch (&capture.pending, 1, __ATOMIC_RELAXED);
+    size_t size= LuaCaptureSize (nreplies, replies);
+    unsigned long usec= LuaStatsNow() - glue->rqt.start;
+
+    pthread_mutex_lock (&capture.lock);
+    if (capture.file) {
+        fprintf (capture.file, "%s,\"status\":%d,\"usec\":%lu,\"reply\":%zu}\n", record, status, usec, size);
+        capture.count++;
+        if (capture.max && capture.count >= capture.max) {
+            fclose (capture.file);
+            capture.file= NULL;
+        }
+    }
+    pthread_mutex_unlock (&capture.lock);
+    free (record);
+}
+
+json_object *LuaCaptureJson (void) {
+    json_object *captureJ;
+
+    pthread_mutex_lock (&capture.lock);
+    wrap_json_pack (&captureJ, "{sb ss* sI sI sI}"
+        ,"active", capture.file != NULL
+        ,"file", capture.path
+        ,"records", (int64_t)capture.count
+        ,"max", (int64_t)capture.max
+        ,"pending", (int64_t)capture.pending
+    );
+    pthread_mutex_unlock (&capture.lock);
+    return captureJ;
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Per api event dispatcher for libafb.evthandler patterns. Afb keeps choosing
+ * one single best handler per event: every exact name is registered with afb
+ * as is, glob patterns are grouped by their literal prefix and afb only gets
+ * one 'prefix*' handler per group. Within the reached group (then groups of
+ * shorter prefixes) the matching glob with most literal chars runs, when no
+ * lua glob matches the event goes to api control callback as an orphan like
+ * any event afb could not route.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <assert.h>
+
+#include <glue-afb.h>
+#include <glue-utils.h>
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-callbacks.h"
+#include "lua-dispatch.h"
+
+#define LUA_DISPATCH_BUCKETS 256
+
+typedef struct LuaDispatchEntryS {
+    struct LuaDispatchEntryS *next;
+    const char *pattern;
+    size_t weight;              // literal chars, most specific glob wins
+    GlueHandleT *handler;
+} LuaDispatchEntryT;
+
+// one afb event handler: an exact name or a 'prefix*' glob group
+typedef struct LuaDispatchGroupS {
+    struct LuaDispatchGroupS *next;   // hash chain
+    struct LuaDispatchGroupS *parent; // glob group with longest shorter prefix
+    unsigned hash;
+    int exact;
+    size_t prefix;                    // literal prefix length (glob groups)
+    char *afbPattern;
+    LuaDispatchEntryT *entries;       // registration order
+} LuaDispatchGroupT;
+
+typedef struct LuaDispatchS {
+    struct LuaDispatchS *next;
+    afb_api_t apiv4;
+    LuaDispatchGroupT *groups[LUA_DISPATCH_BUCKETS];
+} LuaDispatchT;
+
+static LuaDispatchT *dispatchers;
+
+static unsigned LuaDispatchHash (const char *text, size_t len) {
+    unsigned hash= 2166136261u;
+    for (size_t idx=0; idx < len; idx++) {
+        hash ^= (unsigned char)text[idx];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t LuaDispatchWeight (const char *pattern) {
+    size_t weight=0;
+    for (int idx=0; pattern[idx]; idx++) if (!strchr ("*?[]\\", pattern[idx])) weight++;
+    return weight;
+}
+
+static LuaDispatchGroupT *LuaDispatchFind (LuaDispatchT *dispatch, const char *afbPattern, int exact) {
+    unsigned hash= LuaDispatchHash (afbPattern, strlen(afbPattern));
+    LuaDispatchGroupT *group;
+
+    for (group= dispatch->groups[hash % LUA_DISPATCH_BUCKETS]; group; group= group->next) {
+        if (group->hash == hash && group->exact == exact && !strcmp (group->afbPattern, afbPattern)) return group;
+    }
+    return NULL;
+}
+
+// glob group of longest literal prefix strictly shorter than len
+static LuaDispatchGroupT *LuaDispatchParent (LuaDispatchT *dispatch, const char *prefix, size_t len) {
+    char afbPattern[len+2];
+
+    while (len-- > 0) {
+        memcpy (afbPattern, prefix, len);
+        afbPattern[len]= '*';
+        afbPattern[len+1]= '\0';
+        LuaDispatchGroupT *group= LuaDispatchFind (dispatch, afbPattern, 0);
+        if (group) return group;
+    }
+    return NULL;
+}
+
+static void LuaDispatchOrphan (const char *label, afb_api_t api) {
+    GlueHandleT *glue= (GlueHandleT*) afb_api_get_userdata(api);
+    union afb_ctlarg ctlarg;
+
+    if (!glue || glue->magic != GLUE_API_MAGIC) return;
+    memset (&ctlarg, 0, sizeof(ctlarg));
+    ctlarg.orphan_event.name= label;
+    GlueCtrlCb (api, afb_ctlid_Orphan_Event, &ctlarg, glue);
+}
+
+static void LuaDispatchCb (void *userdata, const char *label, unsigned nparams, afb_data_x4_t const params[], afb_api_t api) {
+    LuaDispatchGroupT *group= (LuaDispatchGroupT*) userdata;
+
+    if (group->exact && group->entries) {
+        GlueEventCb (group->entries->handler, label, nparams, params, api);
+        return;
+    }
+
+    for (; group; group= group->parent) {
+        LuaDispatchEntryT *best= NULL;
+        for (LuaDispatchEntryT *entry= group->entries; entry; entry= entry->next) {
+            if ((!best || entry->weight > best->weight) && !fnmatch (entry->pattern, label, 0)) best= entry;
+        }
+        if (best) {
+            GlueEventCb (best->handler, label, nparams, params, api);
+            return;
+        }
+    }
+    LuaDispatchOrphan (label, api);
+}
+
+static LuaDispatchT *LuaDispatchGet (afb_api_t apiv4) {
+    LuaDispatchT *dispatch;
+
+    for (dispatch= dispatchers; dispatch; dispatch= dispatch->next) {
+        if (dispatch->apiv4 == apiv4) return dispatch;
+    }
+
+    dispatch= calloc (1, sizeof(LuaDispatchT));
+    if (!dispatch) return NULL;
+    dispatch->apiv4= apiv4;
+    dispatch->next= dispatchers;
+    dispatchers= dispatch;
+    return dispatch;
+}
+
+// create group and its afb handler, existing longer prefix groups may get it as parent
+static LuaDispatchGroupT *LuaDispatchGroup (LuaDispatchT *dispatch, const char *pattern, size_t prefix, int exact, const char **errorMsg) {
+    LuaDispatchGroupT *group= calloc (1, sizeof(LuaDispatchGroupT));
+    if (!group) goto OnErrorExit;
+
+    group->exact= exact;
+    group->prefix= prefix;
+    if (exact) group->afbPattern= strdup (pattern);
+    else if (asprintf (&group->afbPattern, "%.*s*", (int)prefix, pattern) < 0) group->afbPattern= NULL;
+    if (!group->afbPattern) goto OnErrorExit;
+
+    *errorMsg= AfbAddOneEvent (dispatch->apiv4, group->afbPattern, group->afbPattern, LuaDispatchCb, group);
+    if (*errorMsg) goto OnErrorExit;
+
+    group->hash= LuaDispatchHash (group->afbPattern, strlen(group->afbPattern));
+    group->next= dispatch->groups[group->hash % LUA_DISPATCH_BUCKETS];
+    dispatch->groups[group->hash % LUA_DISPATCH_BUCKETS]= group;
+    if (exact) return group;
+
+    group->parent= LuaDispatchParent (dispatch, pattern, prefix);
+    for (int idx=0; idx < LUA_DISPATCH_BUCKETS; idx++) {
+        for (LuaDispatchGroupT *other= dispatch->groups[idx]; other; other= other->next) {
+            if (other->exact || other->prefix <= prefix || strncmp (other->afbPattern, pattern, prefix)) continue;
+            if (!other->parent || other->parent->prefix < prefix) other->parent= group;
+        }
+    }
+    return group;
+
+OnErrorExit:
+    if (group) free (group->afbPattern);
+    free (group);
+    if (!*errorMsg) *errorMsg= "evthandler: out of memory";
+    return NULL;
+}
+
+const char *LuaDispatchAdd (afb_api_t apiv4, const char *pattern, GlueHandleT *handler) {
+    const char *errorMsg= NULL;
+    LuaDispatchEntryT *entry=NULL, **tail;
+
+    LuaDispatchT *dispatch= LuaDispatchGet (apiv4);
+    if (!dispatch) {
+        errorMsg= "evthandler: out of memory";
+        goto OnErrorExit;
+    }
+
+    size_t prefix= strcspn (pattern, "*?[\\");
+    int exact= !pattern[prefix];
+
+    LuaDispatchGroupT *group;
+    if (exact) {
+        group= LuaDispatchFind (dispatch, pattern, 1);
+    } else {
+        char afbPattern[prefix+2];
+        memcpy (afbPattern, pattern, prefix);
+        afbPattern[prefix]= '*';
+        afbPattern[prefix+1]= '\0';
+        group= LuaDispatchFind (dispatch, afbPattern, 0);
+    }
+
+    // as with one afb handler per pattern, a pattern is only handled once
+    if (group) {
+        for (tail= &group->entries; *tail; tail= &(*tail)->next) {
+            if (!strcmp ((*tail)->pattern, pattern)) {
+                errorMsg= "evthandler: pattern already registered";
+                goto OnErrorExit;
+            }
+        }
+    } else {
+        group= LuaDispatchGroup (dispatch, pattern, prefix, exact, &errorMsg);
+        if (!group) goto OnErrorExit;
+        tail= &group->entries;
+    }
+
+    entry= calloc (1, sizeof(LuaDispatchEntryT));
+    if (!entry) {
+        errorMsg= "evthandler: out of memory";
+        goto OnErrorExit;
+    }
+    entry->pattern= pattern;
+    entry->weight= LuaDispatchWeight (pattern);
+    entry->handler= handler;
+    *tail= entry;
+    return NULL;
+
+OnErrorExit:
+    return errorMsg;
+}
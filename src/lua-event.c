@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <assert.h>
+#include <wrap-json.h>
+
+#include <glue-afb.h>
+#include <glue-utils.h>
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-event.h"
+
+#define LUA_EVT_SNAPSHOT 100 // delta events push a full state every n push
+#define LUA_EVT_PATH_MAX 256 // cleared key dotted path
+
+// evtnew events, used to resolve subscription patterns
+static GlueHandleT **evtRegistry;
+static int evtCount, evtSize;
+
+int LuaEvtRegister (GlueHandleT *glue) {
+    if (evtCount == evtSize) {
+        int size= evtSize ? evtSize*2 : 32;
+        GlueHandleT **registry= realloc (evtRegistry, size * sizeof(GlueHandleT*));
+        if (!registry) goto OnErrorExit;
+        evtRegistry= registry;
+        evtSize= size;
+    }
+    evtRegistry[evtCount++]= glue;
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
+
+// iterate over api events whose label matches pattern
+GlueHandleT *LuaEvtFind (afb_api_t apiv4, const char *pattern, int *cursor) {
+    while (*cursor < evtCount) {
+        GlueHandleT *glue= evtRegistry[(*cursor)++];
+        if (glue->event.apiv4 != apiv4) continue;
+        if (!fnmatch (pattern, glue->event.async.uid, 0)) return glue;
+    }
+    return NULL;
+}
+
+// json merge-patch (rfc7386) turning prevJ into nextJ, returns 0 when both are equal. Removed or
+// nulled keys are set to null within patch and their dotted path is added to clearedJ, as lua
+// tables cannot hold nil values.
+int LuaEvtDiff (json_object *prevJ, json_object *nextJ, json_object **patchJ, json_object *clearedJ, const char *prefix) {
+    char path[LUA_EVT_PATH_MAX];
+    *patchJ= NULL;
+
+    if (!json_object_is_type(prevJ, json_type_object) || !json_object_is_type(nextJ, json_type_object)) {
+        if (json_object_equal(prevJ, nextJ)) return 0;
+        *patchJ= json_object_get(nextJ);
+        return 1;
+    }
+
+    json_object_object_foreach(prevJ, prevKey, prevValJ) {
+        if (!json_object_object_get_ex(nextJ, prevKey, NULL)) {
+            if (!*patchJ) *patchJ= json_object_new_object();
+            json_object_object_add(*patchJ, prevKey, NULL);
+            snprintf (path, sizeof(path), "%s%s", prefix, prevKey);
+            json_object_array_add(clearedJ, json_object_new_string(path));
+        }
+    }
+
+    // new or modified keys, sub-objects are diffed recursively
+    json_object_object_foreach(nextJ, nextKey, nextValJ) {
+        json_object *oldJ, *valueJ;
+        snprintf (path, sizeof(path), "%s%s.", prefix, nextKey);
+        if (!json_object_object_get_ex(prevJ, nextKey, &oldJ)) valueJ= json_object_get(nextValJ);
+        else if (!LuaEvtDiff(oldJ, nextValJ, &valueJ, clearedJ, path)) continue;
+
+        if (!valueJ) {
+            path[strlen(path)-1]= '\0';
+            json_object_array_add(clearedJ, json_object_new_string(path));
+        }
+        if (!*patchJ) *patchJ= json_object_new_object();
+        json_object_object_add(*patchJ, nextKey, valueJ);
+    }
+    return (*patchJ != NULL);
+}
+
+// push {seq,snapshot} or {seq,patch} instead of full state, return 0 when nothing changed
+static int LuaEvtDelta (GlueHandleT *glue, afb_data_t *data) {
+    afb_data_t stateD;
+    json_object *stateJ, *payloadJ, *patchJ;
+
+    if (afb_data_convert(*data, &afb_type_predefined_json_c, &stateD)) goto OnErrorExit;
+    stateJ= json_object_get((json_object*)afb_data_ro_pointer(stateD));
+    afb_data_unref(stateD);
+
+    int snapshot= (!glue->event.stateJ || (glue->event.snapshot && glue->event.seq % glue->event.snapshot == 0));
+    if (snapshot) {
+        wrap_json_pack (&payloadJ, "{si sO}", "seq", glue->event.seq, "snapshot", stateJ);
+    } else {
+        json_object *clearedJ= json_object_new_array();
+        if (!LuaEvtDiff(glue->event.stateJ, stateJ, &patchJ, clearedJ, "")) {
+            json_object_put(clearedJ);
+            json_object_put(stateJ);
+            afb_data_unref(*data);
+            return 0;
+        }
+        wrap_json_pack (&payloadJ, "{si}", "seq", glue->event.seq);
+        json_object_object_add(payloadJ, "patch", patchJ);
+        if (json_object_array_length(clearedJ)) json_object_object_add(payloadJ, "cleared", clearedJ);
+        else json_object_put(clearedJ);
+    }
+
+    json_object_put(glue->event.stateJ);
+    glue->event.stateJ= stateJ;
+    glue->event.seq++;
+
+    afb_data_unref(*data);
+    afb_create_data_raw(data, AFB_PREDEFINED_TYPE_JSON_C, payloadJ, 0, (void *)json_object_put, payloadJ);
+    return 1;
+
+OnErrorExit:
+    afb_data_unref(*data);
+    return -1;
+}
+
+// keep a reference on pushed data for late subscribers, then push
+static int LuaEvtEmit (GlueHandleT *glue, unsigned nparams, afb_data_t const params[]) {
+    afb_data_t data;
+
+    if (glue->event.delta && nparams == 1) {
+        data= params[0];
+        int status= LuaEvtDelta (glue, &data);
+        if (status <= 0) return status;
+        params= &data;
+    }
+
+    if (glue->event.replay && nparams <= LUA_EVT_MAX_PARAMS) {
+        LuaEvtReplayT *slot= &glue->event.ring[glue->event.rhead];
+        for (int idx=0; idx < slot->count; idx++) afb_data_unref(slot->data[idx]);
+        for (int idx=0; idx < nparams; idx++) slot->data[idx]= afb_data_addref(params[idx]);
+        slot->count= nparams;
+
+        glue->event.rhead= (glue->event.rhead +1) % glue->event.replay;
+        if (glue->event.rcount < glue->event.replay) glue->event.rcount++;
+    }
+    return afb_event_push(glue->event.afb, nparams, params);
+}
+
+// number of lua values LuaEvtReplay would push
+int LuaEvtReplayCount (GlueHandleT *glue) {
+    int count=0;
+
+    if (glue->event.delta) return glue->event.stateJ ? 1 : 0;
+    for (int idx=0; idx < glue->event.rcount; idx++) count += glue->event.ring[idx].count;
+    return count;
+}
+
+// push replay ring content as 'afb-data' from oldest to newest
+int LuaEvtReplay (GlueHandleT *glue, lua_State *luaState) {
+    int count=0;
+
+    // delta event new subscriber needs a full snapshot
+    if (glue->event.delta) {
+        afb_data_t data;
+        json_object *payloadJ;
+        if (!glue->event.stateJ) return 0;
+        wrap_json_pack (&payloadJ, "{si sO}", "seq", glue->event.seq-1, "snapshot", glue->event.stateJ);
+        afb_create_data_raw(&data, AFB_PREDEFINED_TYPE_JSON_C, payloadJ, 0, (void *)json_object_put, payloadJ);
+        count= LuaPushAfbData (luaState, 1, &data);
+        afb_data_unref(data);
+        return count;
+    }
+
+    if (!glue->event.rcount) return 0;
+
+    unsigned first= (glue->event.rhead + glue->event.replay - glue->event.rcount) % glue->event.replay;
+    for (int idx=0; idx < glue->event.rcount; idx++) {
+        LuaEvtReplayT *slot= &glue->event.ring[(first + idx) % glue->event.replay];
+        count += LuaPushAfbData (luaState, slot->count, slot->data);
+    }
+    return count;
+}
+
+// push coalesced payload once per window
+static void LuaEvtFlushCb (LuaWheelNodeT *node, unsigned decount) {
+    GlueHandleT *glue= (GlueHandleT*) node->context;
+    assert (glue->magic == GLUE_EVT_MAGIC);
+
+    if (glue->event.batchJ) {
+        afb_data_t data;
+        afb_create_data_raw(&data, AFB_PREDEFINED_TYPE_JSON_C, glue->event.batchJ, 0, (void *)json_object_put, glue->event.batchJ);
+        glue->event.batchJ= NULL;
+        LuaEvtEmit(glue, 1, &data);
+    }
+
+    if (glue->event.npending) {
+        unsigned count= glue->event.npending;
+        glue->event.npending= 0;
+        LuaEvtEmit(glue, count, glue->event.pending);
+    }
+}
+
+// parse evtnew options
+const char *LuaEvtConfig (GlueHandleT *glue, json_object *configJ) {
+    const char *mode=NULL;
+    int coalesce=0, replay=0, snapshot=LUA_EVT_SNAPSHOT;
+
+    int err= wrap_json_unpack (configJ, "{s?i s?s s?i s?b s?i}"
+        ,"coalesce", &coalesce
+        ,"mode", &mode
+        ,"replay", &replay
+        ,"delta", &glue->event.delta
+        ,"snapshot", &snapshot
+    );
+    if (err) goto OnErrorExit;
+    if (coalesce < 0 || snapshot < 0 || replay < 0 || replay > LUA_EVT_REPLAY_MAX) goto OnErrorExit;
+
+    glue->event.coalesce= (unsigned)coalesce;
+    glue->event.snapshot= (unsigned)snapshot;
+    glue->event.replay= (unsigned)replay;
+    if (glue->event.replay) {
+        glue->event.ring= calloc (glue->event.replay, sizeof(LuaEvtReplayT));
+        if (!glue->event.ring) goto OnErrorExit;
+    }
+
+    if (!mode || !strcasecmp (mode, "latest")) glue->event.batch= 0;
+    else if (!strcasecmp (mode, "batch")) glue->event.batch= 1;
+    else goto OnErrorExit;
+
+    glue->event.node.callback= LuaEvtFlushCb;
+    glue->event.node.context= glue;
+    return NULL;
+
+OnErrorExit:
+    return "evtconfig={uid='xxx', coalesce=ms, mode='latest|batch', replay=count, delta=true|false, snapshot=count}";
+}
+
+// push or coalesce event params, params are consumed in every case
+int LuaEvtPush (GlueHandleT *glue, unsigned nparams, afb_data_t const params[]) {
+    if (!glue->event.coalesce) return LuaEvtEmit(glue, nparams, params);
+
+    if (glue->event.batch) {
+        json_object *valueJ;
+        if (!glue->event.batchJ) glue->event.batchJ= json_object_new_array();
+        if (nparams != 1) valueJ= json_object_new_array();
+
+        for (int idx=0; idx < nparams; idx++) {
+            afb_data_t data;
+            json_object *paramJ=NULL;
+            if (!afb_data_convert(params[idx], &afb_type_predefined_json_c, &data)) {
+                paramJ= json_object_get((json_object*)afb_data_ro_pointer(data));
+                afb_data_unref(data);
+            }
+            afb_data_unref(params[idx]);
+            if (nparams == 1) valueJ= paramJ;
+            else json_object_array_add(valueJ, paramJ);
+        }
+        json_object_array_add(glue->event.batchJ, valueJ);
+
+    } else {
+        // only keep latest payload
+        if (nparams > LUA_EVT_MAX_PARAMS) goto OnErrorExit;
+        for (int idx=0; idx < glue->event.npending; idx++) afb_data_unref(glue->event.pending[idx]);
+        for (int idx=0; idx < nparams; idx++) glue->event.pending[idx]= params[idx];
+        glue->event.npending= nparams;
+    }
+
+    if (!LuaWheelIsArmed (&glue->event.node)) {
+        if (LuaWheelArm (&glue->event.node, glue->event.coalesce, 1)) return -1;
+    }
+    return 0;
+
+OnErrorExit:
+    for (int idx=0; idx < nparams; idx++) afb_data_unref(params[idx]);
+    return -1;
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Log message formatter working directly on lua values (no json round trip).
+ * Supports %d %i %o %u %x %X %c %f %F %e %E %g %G %a %A %s %q with flags,
+ * width and precision. Parsed formats are cached by string address, lua
+ * keeps one string per format constant so each call site hits the cache.
+ * Table arguments are dumped as json text straight from lua, they do not go
+ * through json-c and are not counted as marshalling.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-format.h"
+
+#define LUA_FMT_SPEC_MAX 12
+#define LUA_FMT_TRUNCATED "... <truncated>"
+#define LUA_FMT_TABLE_MAX 1024  // dumped table text (including '\0')
+#define LUA_FMT_TABLE_DEPTH 8
+
+typedef struct {
+    unsigned offset;    // literal start within format
+    unsigned length;    // literal length
+    char conv;          // conversion, 0 for literal segment
+    char spec[LUA_FMT_SPEC_MAX]; // '%' + flags + width + precision
+} LuaFmtSegT;
+
+typedef struct {
+    const void *key;    // format address (or caller provided key)
+    char *copy;         // format content, address may be reused by another string
+    size_t length;
+    unsigned count;
+    LuaFmtSegT segs[LUA_FMT_MAX_SEGS];
+} LuaFmtParsedT;
+
+static LuaFmtParsedT fmtCache[LUA_FMT_CACHE];
+static pthread_mutex_t fmtLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void LuaFmtParse (LuaFmtParsedT *parsed, const char *format, size_t length) {
+    size_t idx=0, start=0;
+    unsigned count=0;
+
+    while (idx < length && count < LUA_FMT_MAX_SEGS -1) {
+        if (format[idx] != '%') {
+            idx++;
+            continue;
+        }
+
+        // flush pending literal
+        if (idx > start) {
+            parsed->segs[count++]= (LuaFmtSegT){.offset= (unsigned)start, .length= (unsigned)(idx-start)};
+        }
+
+        // '%%' is a one char literal
+        if (idx+1 < length && format[idx+1] == '%') {
+            parsed->segs[count++]= (LuaFmtSegT){.offset= (unsigned)idx+1, .length= 1};
+            idx += 2;
+            start= idx;
+            continue;
+        }
+
+        LuaFmtSegT *seg= &parsed->segs[count++];
+        size_t spec=1;
+        memset (seg, 0, sizeof(LuaFmtSegT));
+        seg->spec[0]= '%';
+        for (idx++; idx < length && strchr ("-+ #0123456789.", format[idx]); idx++) {
+            if (spec < LUA_FMT_SPEC_MAX -1) seg->spec[spec++]= format[idx];
+        }
+        if (idx < length && strchr ("diouxXcfFeEgGaAsq", format[idx])) seg->conv= format[idx++];
+        else seg->conv= 's';
+        start= idx;
+    }
+
+    // trailing literal (including what does not fit in segment table)
+    if (length > start) {
+        parsed->segs[count++]= (LuaFmtSegT){.offset= (unsigned)start, .length= (unsigned)(length-start)};
+    }
+    parsed->count= count;
+}
+
+// return a private copy of parsed format, cache is only locked for lookup
+static void LuaFmtLookup (LuaFmtParsedT *parsed, const void *key, const char *format, size_t length) {
+    LuaFmtParsedT *entry= &fmtCache[((unsigned long)key >> 3) % LUA_FMT_CACHE];
+
+    pthread_mutex_lock (&fmtLock);
+    if (entry->key == key && entry->length == length && !memcmp (entry->copy, format, length)) {
+        memcpy (parsed, entry, sizeof(LuaFmtParsedT));
+        pthread_mutex_unlock (&fmtLock);
+        return;
+    }
+    pthread_mutex_unlock (&fmtLock);
+
+    LuaFmtParse (parsed, format, length);
+
+    char *copy= malloc (length+1);
+    if (!copy) return;
+    memcpy (copy, format, length);
+    copy[length]='\0';
+
+    pthread_mutex_lock (&fmtLock);
+    free (entry->copy);
+    memcpy (entry, parsed, sizeof(LuaFmtParsedT));
+    entry->key= key;
+    entry->copy= copy;
+    entry->length= length;
+    pthread_mutex_unlock (&fmtLock);
+}
+
+static void LuaFmtAppend (char *buffer, size_t size, size_t *pos, const char *text, size_t len) {
+    if (*pos + len >= size) len= size - *pos -1;
+    memcpy (&buffer[*pos], text, len);
+    *pos += len;
+}
+
+static void LuaFmtJsonString (char *buffer, size_t size, size_t *pos, const char *text, size_t len) {
+    LuaFmtAppend (buffer, size, pos, "\"", 1);
+    for (size_t idx=0; idx < len && *pos < size-1; idx++) {
+        unsigned char car= (unsigned char)text[idx];
+        char escape[8];
+        if (car == '"' || car == '\\') {
+            escape[0]= '\\';
+            escape[1]= (char)car;
+            LuaFmtAppend (buffer, size, pos, escape, 2);
+        } else if (car < 0x20) {
+            int elen= snprintf (escape, sizeof(escape), "\\u%04x", car);
+            LuaFmtAppend (buffer, size, pos, escape, (size_t)elen);
+        } else {
+            buffer[(*pos)++]= (char)car;
+        }
+    }
+    LuaFmtAppend (buffer, size, pos, "\"", 1);
+}
+
+// dump table at index as json text, first key type selects object or array (as LuaTableToJson)
+static void LuaFmtTable (lua_State *luaState, int index, char *buffer, size_t size, size_t *pos, int depth) {
+    char number[32];
+    int isObject=-1;
+
+    if (depth >= LUA_FMT_TABLE_DEPTH || !lua_checkstack (luaState, 4)) {
+        LuaFmtAppend (buffer, size, pos, "\"table\"", 7);
+        return;
+    }
+
+    index= lua_absindex (luaState, index);
+    lua_pushnil (luaState);
+    while (lua_next (luaState, index)) {
+        if (isObject < 0) {
+            isObject= (lua_type (luaState, -2) == LUA_TSTRING);
+            LuaFmtAppend (buffer, size, pos, isObject ? "{" : "[", 1);
+        } else {
+            LuaFmtAppend (buffer, size, pos, ",", 1);
+        }
+
+        if (isObject) {
+            size_t len;
+            // never lua_tostring a number key in place, it would break lua_next
+            lua_pushvalue (luaState, -2);
+            const char *key= luaL_tolstring (luaState, -1, &len);
+            LuaFmtJsonString (buffer, size, pos, key, len);
+            LuaFmtAppend (buffer, size, pos, ":", 1);
+            lua_pop (luaState, 2);
+        }
+
+        switch (lua_type (luaState, -1)) {
+            case LUA_TNUMBER: {
+                int len;
+                if (lua_isinteger (luaState, -1)) len= snprintf (number, sizeof(number), "%lld", (long long)lua_tointeger (luaState, -1));
+                else len= snprintf (number, sizeof(number), "%.14g", (double)lua_tonumber (luaState, -1));
+                LuaFmtAppend (buffer, size, pos, number, (size_t)len);
+                break;
+            }
+            case LUA_TBOOLEAN:
+                if (lua_toboolean (luaState, -1)) LuaFmtAppend (buffer, size, pos, "true", 4);
+                else LuaFmtAppend (buffer, size, pos, "false", 5);
+                break;
+            case LUA_TSTRING: {
+                size_t len;
+                const char *text= lua_tolstring (luaState, -1, &len);
+                LuaFmtJsonString (buffer, size, pos, text, len);
+                break;
+            }
+            case LUA_TTABLE:
+                LuaFmtTable (luaState, -1, buffer, size, pos, depth+1);
+                break;
+            default: {
+                const char *name= lua_typename (luaState, lua_type (luaState, -1));
+                LuaFmtJsonString (buffer, size, pos, name, strlen (name));
+            }
+        }
+        lua_pop (luaState, 1);
+    }
+
+    if (isObject < 0) LuaFmtAppend (buffer, size, pos, "{}", 2);
+    else LuaFmtAppend (buffer, size, pos, isObject ? "}" : "]", 1);
+}
+
+// snapshot one lua value, tables are dumped as json text (dump should be freed by caller)
+void LuaFmtArg (lua_State *luaState, int index, LuaFmtArgT *arg, char **dump) {
+    *dump= NULL;
+    switch (lua_type (luaState, index)) {
+        case LUA_TNONE:
+        case LUA_TNIL:
+            arg->type= LUA_FMT_NIL;
+            break;
+        case LUA_TBOOLEAN:
+            arg->type= LUA_FMT_BOOL;
+            arg->integer= lua_toboolean (luaState, index);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger (luaState, index)) {
+                arg->type= LUA_FMT_INT;
+                arg->integer= (long long)lua_tointeger (luaState, index);
+            } else {
+                arg->type= LUA_FMT_NUM;
+                arg->number= (double)lua_tonumber (luaState, index);
+            }
+            break;
+        case LUA_TSTRING:
+            arg->type= LUA_FMT_STR;
+            arg->str.text= lua_tolstring (luaState, index, &arg->str.len);
+            break;
+        case LUA_TTABLE: {
+            size_t pos=0;
+            arg->type= LUA_FMT_STR;
+            *dump= malloc (LUA_FMT_TABLE_MAX);
+            if (*dump) {
+                LuaFmtTable (luaState, index, *dump, LUA_FMT_TABLE_MAX, &pos, 0);
+                (*dump)[pos]= '\0';
+                arg->str.text= *dump;
+                arg->str.len= pos;
+            } else {
+                arg->str.text= "{}";
+                arg->str.len= 2;
+            }
+            break;
+        }
+        default:
+            arg->type= LUA_FMT_STR;
+            arg->str.text= lua_typename (luaState, lua_type (luaState, index));
+            arg->str.len= strlen (arg->str.text);
+    }
+}
+
+// snprintf with a spec built from segment (flags/width/precision) + modifier + conversion
+static void LuaFmtPrint (char *buffer, size_t size, size_t *pos, const LuaFmtSegT *seg, const char *modifier, char conv, ...) {
+    char spec[LUA_FMT_SPEC_MAX + 4];
+    va_list args;
+
+    snprintf (spec, sizeof(spec), "%s%s%c", seg->spec, modifier, conv);
+    va_start (args, conv);
+    int len= vsnprintf (&buffer[*pos], size - *pos, spec, args);
+    va_end (args);
+
+    if (len < 0) return;
+    *pos += (size_t)len;
+    if (*pos >= size) *pos= size -1;
+}
+
+// lua %q like quoting
+static void LuaFmtQuote (char *buffer, size_t size, size_t *pos, const char *text, size_t len) {
+    LuaFmtAppend (buffer, size, pos, "\"", 1);
+    for (size_t idx=0; idx < len && *pos < size-1; idx++) {
+        unsigned char car= (unsigned char)text[idx];
+        char escape[5];
+        switch (car) {
+            case '"':  LuaFmtAppend (buffer, size, pos, "\\\"", 2); break;
+            case '\\': LuaFmtAppend (buffer, size, pos, "\\\\", 2); break;
+            case '\n': LuaFmtAppend (buffer, size, pos, "\\n", 2); break;
+            case '\r': LuaFmtAppend (buffer, size, pos, "\\r", 2); break;
+            default:
+                if (car < 0x20 || car == 0x7f) {
+                    int elen= snprintf (escape, sizeof(escape), "\\%d", car);
+                    LuaFmtAppend (buffer, size, pos, escape, (size_t)elen);
+                } else {
+                    buffer[(*pos)++]= (char)car;
+                }
+        }
+    }
+    LuaFmtAppend (buffer, size, pos, "\"", 1);
+}
+
+// %s spec keeps '-' flag and width, precision is returned apart (-1 when none)
+static void LuaFmtStrSpec (const LuaFmtSegT *seg, LuaFmtSegT *strSeg, long *precision) {
+    size_t idx=1, out=1;
+
+    *precision= -1;
+    strSeg->spec[0]= '%';
+    for (; seg->spec[idx] && strchr ("-+ #0", seg->spec[idx]); idx++) {
+        if (seg->spec[idx] == '-' && out < LUA_FMT_SPEC_MAX -1) strSeg->spec[out++]= '-';
+    }
+    for (; seg->spec[idx] >= '0' && seg->spec[idx] <= '9'; idx++) {
+        if (out < LUA_FMT_SPEC_MAX -1) strSeg->spec[out++]= seg->spec[idx];
+    }
+    if (seg->spec[idx] == '.') *precision= strtol (&seg->spec[idx+1], NULL, 10);
+    strSeg->spec[out]= '\0';
+}
+
+static void LuaFmtString (char *buffer, size_t size, size_t *pos, const LuaFmtSegT *seg, const LuaFmtArgT *arg) {
+    LuaFmtSegT strSeg;
+    long precision;
+    char number[32];
+    const char *text;
+    size_t len;
+
+    switch (arg->type) {
+        case LUA_FMT_NIL:
+            text= "nil";
+            len= 3;
+            break;
+        case LUA_FMT_BOOL:
+            text= arg->integer ? "true" : "false";
+            len= strlen (text);
+            break;
+        case LUA_FMT_INT:
+            len= (size_t)snprintf (number, sizeof(number), "%lld", arg->integer);
+            text= number;
+            break;
+        case LUA_FMT_NUM:
+            len= (size_t)snprintf (number, sizeof(number), "%.14g", arg->number);
+            text= number;
+            break;
+        default:
+            text= arg->str.text;
+            len= arg->str.len;
+    }
+
+    if (seg->conv == 'q' && arg->type == LUA_FMT_STR) {
+        LuaFmtQuote (buffer, size, pos, text, len);
+        return;
+    }
+
+    // user precision truncates text, only flags/width are given to printf
+    LuaFmtStrSpec (seg, &strSeg, &precision);
+    if (precision >= 0 && (size_t)precision < len) len= (size_t)precision;
+    if (strSeg.spec[1] == '\0') LuaFmtAppend (buffer, size, pos, text, len);
+    else LuaFmtPrint (buffer, size, pos, &strSeg, ".*", 's', (int)len, text);
+}
+
+// key identifies format in cache when format content was copied from its original location
+size_t LuaFmtFormatKey (char *buffer, size_t size, const void *key, const char *format, size_t length, unsigned nargs, const LuaFmtArgT *args) {
+    static const LuaFmtArgT nilArg= {.type= LUA_FMT_NIL};
+    LuaFmtParsedT parsed;
+    unsigned argIdx=0;
+    size_t pos=0;
+
+    assert (size > sizeof(LUA_FMT_TRUNCATED));
+    LuaFmtLookup (&parsed, key, format, length);
+
+    for (unsigned idx=0; idx < parsed.count && pos < size-1; idx++) {
+        const LuaFmtSegT *seg= &parsed.segs[idx];
+        if (!seg->conv) {
+            LuaFmtAppend (buffer, size, &pos, &format[seg->offset], seg->length);
+            continue;
+        }
+
+        const LuaFmtArgT *arg= (argIdx < nargs) ? &args[argIdx] : &nilArg;
+        argIdx++;
+
+        switch (seg->conv) {
+            case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+                if (arg->type == LUA_FMT_INT || arg->type == LUA_FMT_BOOL) LuaFmtPrint (buffer, size, &pos, seg, "ll", seg->conv, arg->integer);
+                else if (arg->type == LUA_FMT_NUM) LuaFmtPrint (buffer, size, &pos, seg, "ll", seg->conv, (long long)arg->number);
+                else LuaFmtString (buffer, size, &pos, seg, arg);
+                break;
+
+            case 'c':
+                if (arg->type == LUA_FMT_INT) LuaFmtPrint (buffer, size, &pos, seg, "", 'c', (int)arg->integer);
+                else LuaFmtString (buffer, size, &pos, seg, arg);
+                break;
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (arg->type == LUA_FMT_NUM) LuaFmtPrint (buffer, size, &pos, seg, "", seg->conv, arg->number);
+                else if (arg->type == LUA_FMT_INT) LuaFmtPrint (buffer, size, &pos, seg, "", seg->conv, (double)arg->integer);
+                else LuaFmtString (buffer, size, &pos, seg, arg);
+                break;
+
+            default:
+                LuaFmtString (buffer, size, &pos, seg, arg);
+        }
+    }
+
+    // mark truncated messages
+    if (pos >= size-1) {
+        pos= size-1;
+        memcpy (&buffer[pos - strlen(LUA_FMT_TRUNCATED)], LUA_FMT_TRUNCATED, strlen(LUA_FMT_TRUNCATED));
+    }
+    buffer[pos]= '\0';
+    return pos;
+}
+
+size_t LuaFmtFormat (char *buffer, size_t size, const char *format, size_t length, unsigned nargs, const LuaFmtArgT *args) {
+    return LuaFmtFormatKey (buffer, size, format, format, length, nargs, args);
+}
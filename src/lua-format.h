@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <stddef.h>
+#include "lua-afb.h"
+
+#define LUA_FMT_MAX_ARGS 32   // max log arguments
+#define LUA_FMT_MAX_SEGS 32   // max literal+conversion segments per format
+#define LUA_FMT_CACHE 128     // parsed format cache entries
+
+typedef enum {
+    LUA_FMT_NIL=0,
+    LUA_FMT_BOOL,
+    LUA_FMT_INT,
+    LUA_FMT_NUM,
+    LUA_FMT_STR,
+} LuaFmtTypeE;
+
+// one log argument, strings are not copied
+typedef struct {
+    LuaFmtTypeE type;
+    union {
+        long long integer;
+        double number;
+        struct {
+            const char *text;
+            size_t len;
+        } str;
+    };
+} LuaFmtArgT;
+
+void LuaFmtArg (lua_State *luaState, int index, LuaFmtArgT *arg, char **dump);
+size_t LuaFmtFormat (char *buffer, size_t size, const char *format, size_t length, unsigned nargs, const LuaFmtArgT *args);
+size_t LuaFmtFormatKey (char *buffer, size_t size, const void *key, const char *format, size_t length, unsigned nargs, const LuaFmtArgT *args);
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Garbage collector control: collector mode and parameters from binder
+ * config or lua, plus idle time incremental steps. A wheel node checks every
+ * idle period whether any lua callback ran meanwhile; when none did and none
+ * is still running on any binder thread, one bounded protected collection
+ * step is done there instead of within the next verb.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-hook.h"
+#include "lua-stats.h"
+#include "lua-wheel.h"
+#include "lua-gc.h"
+
+static struct {
+    lua_State *luaState;    // wheel interpretor thread
+    LuaWheelNodeT node;
+    unsigned idle;          // idle check period ms (0=off)
+    int stepKB;
+    unsigned long activity; // hook activity at previous check
+    unsigned long steps;
+    unsigned long cycles;   // collection cycles completed by idle steps
+    LuaHistoT pauses;       // idle step duration (us)
+} collector;
+
+// protected step, with lua-5.3 a finalizer error within an unprotected lua_gc aborts the process
+static int LuaGcStep (lua_State *luaState) {
+    lua_pushboolean (luaState, lua_gc (luaState, LUA_GCSTEP, (int)lua_tointeger (luaState, 1)));
+    return 1;
+}
+
+static void LuaGcIdleCb (LuaWheelNodeT *node, unsigned decount) {
+    lua_State *luaState= collector.luaState;
+    unsigned long activity= LuaHookActivity();
+
+    // some lua callback ran during last period
+    if (activity != collector.activity) {
+        collector.activity= activity;
+        return;
+    }
+
+    // a callback started before last period may still run on another binder thread
+    if (!LuaHookIdleEnter()) return;
+
+    unsigned long start= LuaStatsNow();
+    lua_pushcfunction (luaState, LuaGcStep);
+    lua_pushinteger (luaState, collector.stepKB);
+    if (lua_pcall (luaState, 1, 1, 0) != LUA_OK) {
+        ERROR ("idle gc step failed: %s", lua_tostring (luaState, -1));
+    } else {
+        if (lua_toboolean (luaState, -1)) collector.cycles++;
+        collector.steps++;
+    }
+    lua_pop (luaState, 1);
+    LuaHistoAdd (&collector.pauses, LuaStatsNow() - start);
+    LuaHookIdleLeave();
+}
+
+// gc={mode='incremental|generational', pause=%, stepmul=%, stepsize=log2(KB), idle=ms, idlestep=KB, auto=bool}
+const char *LuaGcConfig (lua_State *luaState, json_object *gcJ) {
+    const char *mode=NULL;
+    int pause=-1, stepmul=-1, stepsize=-1, idle=-1, idlestep=-1, automatic=-1;
+
+    int err= wrap_json_unpack (gcJ, "{s?s s?i s?i s?i s?i s?i s?b !}"
+        ,"mode", &mode
+        ,"pause", &pause
+        ,"stepmul", &stepmul
+        ,"stepsize", &stepsize
+        ,"idle", &idle
+        ,"idlestep", &idlestep
+        ,"auto", &automatic
+    );
+    if (err) goto OnErrorExit;
+
+    // partial config (ex: idle only) keeps previous mode and run state
+    int incremental= (pause >= 0 || stepmul >= 0 || stepsize >= 0);
+#if LUA_VERSION_NUM >= 504
+    if (mode && !strcasecmp (mode, "generational")) {
+        if (incremental) goto OnErrorExit;
+        lua_gc (luaState, LUA_GCGEN, 0, 0);
+    } else if (mode && strcasecmp (mode, "incremental")) {
+        goto OnErrorExit;
+    } else if (mode || incremental) {
+        lua_gc (luaState, LUA_GCINC, pause < 0 ? 0 : pause, stepmul < 0 ? 0 : stepmul, stepsize < 0 ? 0 : stepsize);
+    }
+#else
+    if (mode && strcasecmp (mode, "incremental")) goto OnErrorExit;
+    if (pause >= 0) lua_gc (luaState, LUA_GCSETPAUSE, pause);
+    if (stepmul >= 0) lua_gc (luaState, LUA_GCSETSTEPMUL, stepmul);
+#endif
+
+    // without automatic collection, idle steps (and emergency collection) do the job
+    if (automatic >= 0) lua_gc (luaState, automatic ? LUA_GCRESTART : LUA_GCSTOP, 0);
+
+    if (idlestep >= 0) collector.stepKB= idlestep;
+    else if (!collector.stepKB) collector.stepKB= LUA_GC_IDLE_STEP;
+
+    if (idle >= 0) {
+        collector.idle= (unsigned)idle;
+        collector.luaState= LuaWheelThread (luaState);
+        collector.node.callback= LuaGcIdleCb;
+        if (!collector.idle) LuaWheelDisarm (&collector.node);
+        else if (LuaWheelArm (&collector.node, collector.idle, 0)) goto OnErrorExit;
+    }
+    return NULL;
+
+OnErrorExit:
+    return "gc={mode='incremental|generational', pause=%, stepmul=%, stepsize=n, idle=ms, idlestep=KB, auto=true|false}";
+}
+
+json_object *LuaGcJson (lua_State *luaState) {
+    json_object *gcJ;
+    wrap_json_pack (&gcJ, "{si si sI sI so}"
+        ,"heap", lua_gc (luaState, LUA_GCCOUNT, 0)
+        ,"running", lua_gc (luaState, LUA_GCISRUNNING, 0)
+        ,"steps", (int64_t)collector.steps
+        ,"cycles", (int64_t)collector.cycles
+        ,"pauses", LuaHistoJson(&collector.pauses)
+    );
+    return gcJ;
+}
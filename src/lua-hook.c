@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Lua execution context: every entry point into lua code records which glue
+ * handle runs it, and arms the shared lua instruction hook only when some
+ * feature (profiler, execution budget) requires it. When nothing requires
+ * the hook, lua callbacks run without any hook at all.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-hook.h"
+#include "lua-profile.h"
+#include "lua-stats.h"
+
+static __thread LuaHookCtxT current;
+static unsigned hookFeatures;
+static unsigned hookCount;
+static unsigned long activity;  // lua callbacks count, used to detect idle time
+static int inflight;            // lua callbacks running now on any thread
+
+static void LuaHookCb (lua_State *luaState, lua_Debug *info);
+
+// abort callback with its stack trace, rearm hook to fire at once when lua code catches the error
+static void LuaHookAbort (lua_State *luaState) {
+    if (!current.expired) {
+        current.expired= 1;
+        current.budget->aborts++;
+        luaL_traceback (luaState, luaState, "execution budget exceeded", 0);
+        GLUE_AFB_ERROR (current.glue, "lua callback aborted: %s", lua_tostring(luaState, -1));
+    } else {
+        lua_pushliteral (luaState, "execution budget exceeded");
+    }
+    lua_sethook (luaState, LuaHookCb, LUA_MASKCOUNT, 1);
+    lua_error (luaState);
+}
+
+static void LuaHookCb (lua_State *luaState, lua_Debug *info) {
+    unsigned step= current.step ? current.step : hookCount;
+
+    // hook is not required anymore, remove it from this thread
+    if (!hookFeatures && !current.budget) {
+        lua_sethook (luaState, NULL, 0, 0);
+        return;
+    }
+    current.executed += step;
+
+    if (hookFeatures & LUA_HOOK_PROFILE) {
+        current.profiled += step;
+        if (current.profiled >= hookCount) {
+            current.profiled= 0;
+            LuaProfSample (luaState, current.glue);
+        }
+    }
+
+    if (current.budget) {
+        if (current.expired) LuaHookAbort (luaState);
+        if (current.budget->instructions && current.executed > current.budget->instructions) LuaHookAbort (luaState);
+        if (current.deadline && LuaStatsNow() > current.deadline) LuaHookAbort (luaState);
+    }
+}
+
+void LuaHookEnter (LuaHookCtxT *saved, lua_State *luaState, GlueHandleT *glue) {
+    *saved= current;
+    saved->marshal= LuaMarshalSave();
+    activity++;
+    if (luaState) __atomic_add_fetch (&inflight, 1, __ATOMIC_SEQ_CST);
+    memset (&current, 0, sizeof(current));
+    current.glue= glue;
+    current.luaState= luaState;
+    if (luaState && hookFeatures) {
+        current.step= hookCount;
+        lua_sethook (luaState, LuaHookCb, LUA_MASKCOUNT, hookCount);
+    }
+}
+
+// apply budget to current context, check interval is shared with profiler
+void LuaHookBudget (LuaBudgetT *budget) {
+    if (!budget || !current.luaState || (!budget->instructions && !budget->timeout)) return;
+
+    current.budget= budget;
+    if (budget->timeout) current.deadline= LuaStatsNow() + (unsigned long)budget->timeout * 1000;
+
+    current.step= LUA_BUDGET_STEP;
+    if (budget->instructions && budget->instructions < current.step) current.step= (unsigned)budget->instructions;
+    if (hookFeatures && hookCount < current.step) current.step= hookCount;
+    lua_sethook (current.luaState, LuaHookCb, LUA_MASKCOUNT, current.step);
+}
+
+int LuaHookExpired (void) {
+    return current.expired;
+}
+
+unsigned long LuaHookActivity (void) {
+    return activity;
+}
+
+void LuaHookLeave (LuaHookCtxT *saved) {
+    if (current.luaState) __atomic_sub_fetch (&inflight, 1, __ATOMIC_SEQ_CST);
+    LuaMarshalRestore (saved->marshal);
+    current= *saved;
+}
+
+// claim lua state for out of callback work (idle gc step), fails when any callback is running
+int LuaHookIdleEnter (void) {
+    int expected= 0;
+    return __atomic_compare_exchange_n (&inflight, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void LuaHookIdleLeave (void) {
+    __atomic_sub_fetch (&inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+GlueHandleT *LuaHookCurrent (void) {
+    return current.glue;
+}
+
+LuaHookCtxT *LuaHookCtx (void) {
+    return &current;
+}
+
+// api name used to aggregate per api data
+const char *LuaHookLabel (GlueHandleT *glue) {
+    afb_api_t apiv4;
+
+    if (!glue) return "binder";
+    if (glue->magic == GLUE_TIMER_MAGIC) apiv4= glue->timer.apiv4;
+    else apiv4= GlueGetApi(glue);
+    if (!apiv4) return "binder";
+    return afb_api_name (apiv4);
+}
+
+// hook fires every 'count' instructions, smallest request wins
+void LuaHookRequire (unsigned feature, unsigned count) {
+    if (!count) count= 1;
+    if (!hookFeatures || count < hookCount) hookCount= count;
+    hookFeatures |= feature;
+}
+
+void LuaHookRelease (unsigned feature) {
+    hookFeatures &= ~feature;
+}
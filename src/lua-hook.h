@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include "lua-afb.h"
+
+// features requiring lua instruction hook
+#define LUA_HOOK_PROFILE 0x01
+
+#define LUA_BUDGET_STEP 1000 // instructions between budget checks
+
+// lua code execution context, saved/restored around each lua_pcall
+typedef struct {
+    GlueHandleT *glue;
+    lua_State *luaState;
+    LuaMemStatsT *mem;  // api memory accounting, resolved on first allocation
+    int resolved;
+    LuaBudgetT *budget; // execution budget (NULL=unlimited)
+    unsigned long deadline;
+    unsigned long executed;
+    unsigned long profiled;
+    unsigned step;      // instructions between hook calls
+    int expired;
+    unsigned marshal;   // enclosing context marshal depth
+} LuaHookCtxT;
+
+void LuaHookEnter (LuaHookCtxT *saved, lua_State *luaState, GlueHandleT *glue);
+void LuaHookLeave (LuaHookCtxT *saved);
+void LuaHookBudget (LuaBudgetT *budget);
+int  LuaHookExpired (void);
+unsigned long LuaHookActivity (void);
+int  LuaHookIdleEnter (void);
+void LuaHookIdleLeave (void);
+GlueHandleT *LuaHookCurrent (void);
+LuaHookCtxT *LuaHookCtx (void);
+const char *LuaHookLabel (GlueHandleT *glue);
+void LuaHookRequire (unsigned feature, unsigned count);
+void LuaHookRelease (unsigned feature);
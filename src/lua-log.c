@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Asynchronous lua logging: lua thread only captures level, call site and raw
+ * arguments into a bounded lock-free ring (multi producers, one consumer);
+ * a background thread formats and emits them. When the ring is full messages
+ * are dropped and counted, lua never waits for the logger.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <assert.h>
+
+#include <wrap-json.h>
+#include <libafb/sys/verbose.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-format.h"
+#include "lua-log.h"
+
+typedef struct {
+    atomic_size_t sequence;   // slot state (free when sequence==position)
+    int magic;                // emitter handle type
+    union {
+        afb_api_t api;
+        afb_req_t req;        // referenced until emitted
+    };
+    int level;
+    int line;
+    const char *func;
+    const void *key;          // original format address, used as format cache key
+    const char *format;
+    size_t length;
+    unsigned nargs;
+    LuaFmtArgT args[LUA_LOG_ARGS];
+    char source[LUA_IDSIZE];
+    char payload[LUA_LOG_PAYLOAD];
+} LuaLogSlotT;
+
+static struct {
+    LuaLogSlotT *slots;
+    size_t mask;
+    atomic_size_t head;       // next producer position
+    size_t tail;              // next consumer position
+    sem_t wake;
+    pthread_t thread;
+    int started;
+    atomic_int async;
+    atomic_ulong pushed;
+    atomic_ulong dropped;
+    atomic_ulong truncated;
+    atomic_ulong emitted;
+    unsigned long reported;   // drops already reported by consumer
+} ring;
+
+int LuaLogAsync (void) {
+    return atomic_load_explicit (&ring.async, memory_order_relaxed);
+}
+
+static void LuaLogVerbose (LuaLogSlotT *slot, int level, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    switch (slot->magic) {
+        case GLUE_API_MAGIC:
+        case GLUE_EVT_MAGIC:
+        case GLUE_JOB_MAGIC:
+            afb_api_vverbose (slot->api, level, slot->source, slot->line, slot->func, fmt, args);
+            break;
+
+        case GLUE_RQT_MAGIC:
+            afb_req_vverbose (slot->req, level, slot->source, slot->line, slot->func, fmt, args);
+            break;
+
+        default:
+            vverbose (level, slot->source, slot->line, slot->func, fmt, args);
+    }
+    va_end(args);
+}
+
+static void *LuaLogThread (void *context) {
+    char message[LUA_MSG_MAX_LENGTH];
+
+    for (;;) {
+        if (sem_wait (&ring.wake)) continue; // EINTR
+
+        // producers may publish out of order, wait for the oldest one
+        LuaLogSlotT *slot= &ring.slots[ring.tail & ring.mask];
+        while (atomic_load_explicit (&slot->sequence, memory_order_acquire) != ring.tail +1) sched_yield();
+
+        LuaFmtFormatKey (message, sizeof(message), slot->key, slot->format, slot->length, slot->nargs, slot->args);
+        LuaLogVerbose (slot, slot->level, "%s", message);
+
+        // drops are reported while slot (and its request) is still owned by consumer
+        unsigned long dropped= atomic_load_explicit (&ring.dropped, memory_order_relaxed);
+        if (dropped != ring.reported) {
+            LuaLogVerbose (slot, AFB_SYSLOG_LEVEL_WARNING, "async log ring full, %lu messages dropped", dropped - ring.reported);
+            ring.reported= dropped;
+        }
+        if (slot->magic == GLUE_RQT_MAGIC) afb_req_unref (slot->req);
+
+        // release slot for next ring round
+        atomic_store_explicit (&slot->sequence, ring.tail + ring.mask +1, memory_order_release);
+        ring.tail++;
+        atomic_fetch_add_explicit (&ring.emitted, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+static int LuaLogStart (size_t size) {
+    size_t count;
+    pthread_attr_t attr;
+
+    if (ring.started) return 0;
+    for (count=1; count < size; count <<= 1);
+
+    ring.slots= calloc (count, sizeof(LuaLogSlotT));
+    if (!ring.slots) goto OnErrorExit;
+    for (size_t idx=0; idx < count; idx++) atomic_init (&ring.slots[idx].sequence, idx);
+    ring.mask= count -1;
+    if (sem_init (&ring.wake, 0, 0)) goto OnErrorExit;
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    int err= pthread_create (&ring.thread, &attr, LuaLogThread, NULL);
+    pthread_attr_destroy (&attr);
+    if (err) goto OnErrorExit;
+
+    ring.started= 1;
+    return 0;
+
+OnErrorExit:
+    free (ring.slots);
+    ring.slots= NULL;
+    return -1;
+}
+
+// logger={async=true|false, ring=slots}, ring size only applies before first start
+const char *LuaLogConfig (json_object *logJ) {
+    int async=-1, size=LUA_LOG_RING;
+
+    int err= wrap_json_unpack (logJ, "{s?b s?i !}"
+        ,"async", &async
+        ,"ring", &size
+    );
+    if (err || size <= 0) goto OnErrorExit;
+
+    if (async > 0 && LuaLogStart ((size_t)size)) goto OnErrorExit;
+    if (async >= 0) atomic_store (&ring.async, async);
+    return NULL;
+
+OnErrorExit:
+    return "logger={async=true|false, ring=slots}";
+}
+
+// copy text within slot payload, returns copied length
+static size_t LuaLogCopy (LuaLogSlotT *slot, size_t *used, const char *text, size_t len, const char **copy) {
+    size_t room= LUA_LOG_PAYLOAD - *used;
+
+    if (!room) {
+        *copy= "";
+        atomic_fetch_add_explicit (&ring.truncated, 1, memory_order_relaxed);
+        return 0;
+    }
+    if (len >= room) {
+        len= room -1;
+        atomic_fetch_add_explicit (&ring.truncated, 1, memory_order_relaxed);
+    }
+    memcpy (&slot->payload[*used], text, len);
+    slot->payload[*used + len]= '\0';
+    *copy= &slot->payload[*used];
+    *used += len +1;
+    return len;
+}
+
+// capture one message, returns -1 when dropped (ring full)
+int LuaLogPush (lua_State *luaState, GlueHandleT *glue, int level, const char *func, const char *format, size_t length, int first, int last) {
+    LuaFmtArgT args[LUA_LOG_ARGS];
+    char *dumps[LUA_LOG_ARGS];
+    lua_Debug luaDebug;
+    unsigned nargs=0;
+    size_t used=0;
+    int line= -1;
+    const char *source= "unk";
+
+    // lua api calls are done before claiming a slot, a lua error would leave it busy forever
+    for (int idx=first; idx <= last && nargs < LUA_LOG_ARGS; idx++, nargs++) {
+        LuaFmtArg (luaState, idx, &args[nargs], &dumps[nargs]);
+    }
+    if (lua_getstack (luaState, 1, &luaDebug)) {
+        lua_getinfo (luaState, "Sl", &luaDebug);
+        line= luaDebug.currentline;
+        source= luaDebug.short_src;
+    }
+
+    // claim one slot
+    size_t position= atomic_load_explicit (&ring.head, memory_order_relaxed);
+    LuaLogSlotT *slot;
+    for (;;) {
+        slot= &ring.slots[position & ring.mask];
+        size_t sequence= atomic_load_explicit (&slot->sequence, memory_order_acquire);
+        intptr_t diff= (intptr_t)sequence - (intptr_t)position;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit (&ring.head, &position, position+1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit (&ring.dropped, 1, memory_order_relaxed);
+            goto OnDropExit;
+        } else {
+            position= atomic_load_explicit (&ring.head, memory_order_relaxed);
+        }
+    }
+
+    slot->magic= glue->magic;
+    switch (glue->magic) {
+        case GLUE_API_MAGIC:
+        case GLUE_EVT_MAGIC:
+        case GLUE_JOB_MAGIC:
+            slot->api= GlueGetApi (glue);
+            break;
+        case GLUE_RQT_MAGIC:
+            slot->req= afb_req_addref (glue->rqt.afb);
+            break;
+        default:
+            slot->api= NULL;
+    }
+    slot->level= level;
+    slot->line= line;
+    slot->func= func;
+    slot->key= format;
+    snprintf (slot->source, sizeof(slot->source), "%s", source);
+    slot->length= LuaLogCopy (slot, &used, format, length, &slot->format);
+
+    for (unsigned idx=0; idx < nargs; idx++) {
+        slot->args[idx]= args[idx];
+        if (args[idx].type == LUA_FMT_STR) {
+            slot->args[idx].str.len= LuaLogCopy (slot, &used, args[idx].str.text, args[idx].str.len, &slot->args[idx].str.text);
+        }
+    }
+    slot->nargs= nargs;
+
+    atomic_store_explicit (&slot->sequence, position +1, memory_order_release);
+    atomic_fetch_add_explicit (&ring.pushed, 1, memory_order_relaxed);
+    sem_post (&ring.wake);
+
+    for (unsigned idx=0; idx < nargs; idx++) free (dumps[idx]);
+    return 0;
+
+OnDropExit:
+    for (unsigned idx=0; idx < nargs; idx++) free (dumps[idx]);
+    return -1;
+}
+
+json_object *LuaLogJson (void) {
+    json_object *logJ;
+    unsigned long pushed= atomic_load (&ring.pushed);
+    unsigned long emitted= atomic_load (&ring.emitted);
+
+    wrap_json_pack (&logJ, "{sb sI sI sI sI sI sI}"
+        ,"async", LuaLogAsync()
+        ,"ring", (int64_t)(ring.started ? ring.mask +1 : 0)
+        ,"pushed", (int64_t)pushed
+        ,"emitted", (int64_t)emitted
+        ,"pending", (int64_t)(pushed - emitted)
+        ,"dropped", (int64_t)atomic_load (&ring.dropped)
+        ,"truncated", (int64_t)atomic_load (&ring.truncated)
+    );
+    return logJ;
+}
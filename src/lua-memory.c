@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Lua allocator wrapper: count lua heap usage globally and per api, and
+ * enforce an optional global maxmem limit. Allocation is attributed to the
+ * api whose lua code is running (see lua-hook), memory released by garbage
+ * collector is credited to the api running when collection happens, per api
+ * figures are an approximation (an api live count may drift, even below zero)
+ * while global ones are exact. As blocks allocated before install have no
+ * owner, limits are never enforced on per api figures.
+ *
+ * The limit is only enforced within a protected lua call started by the glue.
+ * Exceeding it fails the allocation, lua raises a memory error that ends in
+ * an error reply.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-hook.h"
+#include "lua-memory.h"
+
+static struct {
+    lua_Alloc allocf;
+    void *ud;
+    LuaMemStatsT global;
+} memory;
+
+LuaMemStatsT *LuaMemGlobal (void) {
+    return &memory.global;
+}
+
+// api accounting for any glue handle (NULL when not attached to a lua api)
+LuaMemStatsT *LuaMemOf (GlueHandleT *glue) {
+    GlueHandleT *api= GlueGetApiHandle(glue);
+    if (!api) return NULL;
+    return &api->api.mem;
+}
+
+static void LuaMemAccount (LuaMemStatsT *mem, size_t oldsize, size_t nsize) {
+    mem->live += (long)nsize - (long)oldsize;
+    if (nsize > oldsize) {
+        mem->allocs++;
+        mem->bytes += nsize - oldsize;
+    }
+}
+
+static int LuaMemOver (LuaMemStatsT *mem, size_t grow) {
+    if (!mem || !mem->maxmem) return 0;
+    return (mem->live + (long)grow > (long)mem->maxmem);
+}
+
+static void *LuaMemAlloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+    size_t oldsize= ptr ? osize : 0; // osize is a type tag for new blocks
+    LuaHookCtxT *ctx= LuaHookCtx();
+    void *block;
+
+    if (ctx->glue && !ctx->resolved) {
+        ctx->mem= LuaMemOf (ctx->glue);
+        ctx->resolved= 1;
+    }
+
+    // shrinking should never fail, growing is refused over maxmem
+    if (ctx->glue && nsize > oldsize) {
+        size_t grow= nsize - oldsize;
+        if (LuaMemOver (&memory.global, grow)) {
+            memory.global.failures++;
+            if (ctx->mem) ctx->mem->failures++;
+            return NULL;
+        }
+    }
+
+    block= memory.allocf (memory.ud, ptr, osize, nsize);
+    if (!block && nsize) return NULL;
+
+    LuaMemAccount (&memory.global, oldsize, nsize);
+    if (ctx->mem) LuaMemAccount (ctx->mem, oldsize, nsize);
+    if (ctx->glue && ctx->glue->magic == GLUE_RQT_MAGIC && nsize > oldsize) {
+        ctx->glue->rqt.allocs++;
+        ctx->glue->rqt.allocBytes += nsize - oldsize;
+    }
+    return block;
+}
+
+// chain lua allocator, blocks allocated before install are freed by the same libc
+void LuaMemInstall (lua_State *luaState) {
+    if (memory.allocf) return;
+    memory.allocf= lua_getallocf (luaState, &memory.ud);
+    memory.global.live= (long)lua_gc (luaState, LUA_GCCOUNT, 0) * 1024 + lua_gc (luaState, LUA_GCCOUNTB, 0);
+    lua_setallocf (luaState, LuaMemAlloc, NULL);
+}
+
+json_object *LuaMemJson (LuaMemStatsT *mem) {
+    json_object *memJ;
+    wrap_json_pack (&memJ, "{sI sI sI sI sI}"
+        ,"live", (int64_t)mem->live
+        ,"allocs", (int64_t)mem->allocs
+        ,"bytes", (int64_t)mem->bytes
+        ,"failures", (int64_t)mem->failures
+        ,"maxmem", (int64_t)mem->maxmem
+    );
+    return memJ;
+}
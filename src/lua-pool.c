@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Slab pools for fixed size control blocks and interned strings. Slabs and
+ * interned strings live until binder exit, after warmup async hot path
+ * does not hit the heap anymore. The intern table is never pruned: it grows
+ * with each distinct callback name and api/verb uid, scripts building verb
+ * or callback names dynamically (one per request id, ...) leak one entry per
+ * name and should use callsync or a fixed set of names instead.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lua-pool.h"
+
+#define LUA_INTERN_BUCKETS 256
+#define LUA_UID_MAX_LENGTH 256
+
+typedef struct LuaInternS {
+    struct LuaInternS *next;
+    unsigned hash;
+    char text[];
+} LuaInternT;
+
+LuaPoolT glueCallPool = LUA_POOL_INITIALIZER(GlueCallHandleT);
+
+static LuaInternT *internTable[LUA_INTERN_BUCKETS];
+static pthread_mutex_t internLock = PTHREAD_MUTEX_INITIALIZER;
+
+// return a zeroed object, allocate a new slab when pool is empty
+void *LuaPoolGet (LuaPoolT *pool) {
+    LuaPoolFreeT *object;
+    size_t size= pool->size < sizeof(LuaPoolFreeT) ? sizeof(LuaPoolFreeT) : pool->size;
+
+    pthread_mutex_lock (&pool->lock);
+    if (!pool->free) {
+        char *slab= malloc (size * LUA_POOL_SLAB);
+        if (!slab) goto OnErrorExit;
+        for (int idx=0; idx < LUA_POOL_SLAB; idx++) {
+            LuaPoolFreeT *slot= (LuaPoolFreeT*) &slab[idx * size];
+            slot->next= pool->free;
+            pool->free= slot;
+        }
+    }
+    object= pool->free;
+    pool->free= object->next;
+    pthread_mutex_unlock (&pool->lock);
+
+    memset (object, 0, size);
+    return object;
+
+OnErrorExit:
+    pthread_mutex_unlock (&pool->lock);
+    return NULL;
+}
+
+void LuaPoolPut (LuaPoolT *pool, void *object) {
+    LuaPoolFreeT *slot= (LuaPoolFreeT*) object;
+    if (!object) return;
+
+    pthread_mutex_lock (&pool->lock);
+    slot->next= pool->free;
+    pool->free= slot;
+    pthread_mutex_unlock (&pool->lock);
+}
+
+// FNV-1a string hash
+static unsigned LuaStrHash (const char *text) {
+    unsigned hash= 2166136261u;
+    for (int idx=0; text[idx]; idx++) {
+        hash ^= (unsigned char)text[idx];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// return a unique copy of text, interned strings are never freed
+const char *LuaStrIntern (const char *text) {
+    LuaInternT *intern;
+
+    if (!text) return NULL;
+    unsigned hash= LuaStrHash (text);
+
+    pthread_mutex_lock (&internLock);
+    for (intern= internTable[hash % LUA_INTERN_BUCKETS]; intern; intern= intern->next) {
+        if (intern->hash == hash && !strcmp (intern->text, text)) goto OnFoundExit;
+    }
+
+    size_t len= strlen(text);
+    intern= malloc (sizeof(LuaInternT) + len +1);
+    if (!intern) goto OnErrorExit;
+    intern->hash= hash;
+    memcpy (intern->text, text, len+1);
+    intern->next= internTable[hash % LUA_INTERN_BUCKETS];
+    internTable[hash % LUA_INTERN_BUCKETS]= intern;
+
+OnFoundExit:
+    pthread_mutex_unlock (&internLock);
+    return intern->text;
+
+OnErrorExit:
+    pthread_mutex_unlock (&internLock);
+    return NULL;
+}
+
+// intern 'api/verb' uid without building a temporary heap string, NULL when uid is too long
+const char *LuaUidIntern (const char *apiname, const char *verbname) {
+    char uid[LUA_UID_MAX_LENGTH];
+
+    int len= snprintf (uid, sizeof(uid), "%s/%s", apiname, verbname);
+    if (len < 0 || len >= sizeof(uid)) return NULL;
+    return LuaStrIntern (uid);
+}
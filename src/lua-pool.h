@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "lua-afb.h"
+
+#define LUA_POOL_SLAB 64 // objects allocated per slab
+
+typedef struct LuaPoolFreeS {
+    struct LuaPoolFreeS *next;
+} LuaPoolFreeT;
+
+typedef struct {
+    size_t size;
+    LuaPoolFreeT *free;
+    pthread_mutex_t lock;
+} LuaPoolT;
+
+#define LUA_POOL_INITIALIZER(type) {.size= sizeof(type), .free= NULL, .lock= PTHREAD_MUTEX_INITIALIZER}
+
+// control blocks used by callasync/jobpost
+extern LuaPoolT glueCallPool;
+
+void *LuaPoolGet (LuaPoolT *pool);
+void LuaPoolPut (LuaPoolT *pool, void *object);
+
+const char *LuaStrIntern (const char *text);
+const char *LuaUidIntern (const char *apiname, const char *verbname);
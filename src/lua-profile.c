@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Sampling profiler: lua count hook takes a stack sample every N instructions
+ * (optionally at most once per period). Samples are aggregated per api as
+ * folded stacks ("api;func (file:line);... count") ready for flamegraph.pl.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-hook.h"
+#include "lua-stats.h"
+#include "lua-profile.h"
+
+#define LUA_PROF_BUCKETS 1024
+#define LUA_PROF_MAX_STACK 2048
+
+typedef struct LuaProfEntryS {
+    struct LuaProfEntryS *next;
+    unsigned hash;
+    unsigned long count;
+    char stack[];
+} LuaProfEntryT;
+
+static struct {
+    int running;
+    unsigned long period;   // min us between samples (0=every hook)
+    unsigned long next;
+    unsigned long samples;
+    LuaProfEntryT *table[LUA_PROF_BUCKETS];
+} profiler;
+
+static unsigned LuaProfHash (const char *text, size_t len) {
+    unsigned hash= 2166136261u;
+    for (size_t idx=0; idx < len; idx++) {
+        hash ^= (unsigned char)text[idx];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void LuaProfCount (const char *stack, size_t len) {
+    LuaProfEntryT *entry;
+    unsigned hash= LuaProfHash (stack, len);
+
+    for (entry= profiler.table[hash % LUA_PROF_BUCKETS]; entry; entry= entry->next) {
+        if (entry->hash == hash && !strcmp (entry->stack, stack)) {
+            entry->count++;
+            return;
+        }
+    }
+
+    entry= malloc (sizeof(LuaProfEntryT) + len +1);
+    if (!entry) return;
+    entry->hash= hash;
+    entry->count= 1;
+    memcpy (entry->stack, stack, len+1);
+    entry->next= profiler.table[hash % LUA_PROF_BUCKETS];
+    profiler.table[hash % LUA_PROF_BUCKETS]= entry;
+}
+
+// called from lua hook, build folded stack from root to leaf
+void LuaProfSample (lua_State *luaState, GlueHandleT *glue) {
+    lua_Debug frames[LUA_PROF_DEPTH];
+    char stack[LUA_PROF_MAX_STACK];
+    int depth, len;
+
+    if (!profiler.running) return;
+    if (profiler.period) {
+        unsigned long now= LuaStatsNow();
+        if (now < profiler.next) return;
+        profiler.next= now + profiler.period;
+    }
+
+    for (depth=0; depth < LUA_PROF_DEPTH; depth++) {
+        if (!lua_getstack (luaState, depth, &frames[depth])) break;
+        lua_getinfo (luaState, "Sn", &frames[depth]);
+    }
+
+    len= snprintf (stack, sizeof(stack), "%s", LuaHookLabel(glue));
+    for (int idx= depth-1; idx >= 0 && len < sizeof(stack); idx--) {
+        lua_Debug *frame= &frames[idx];
+        if (*frame->what == 'C') {
+            len += snprintf (&stack[len], sizeof(stack)-len, ";%s [C]", frame->name ? frame->name : "?");
+        } else {
+            len += snprintf (&stack[len], sizeof(stack)-len, ";%s (%s:%d)", frame->name ? frame->name : "?", frame->short_src, frame->linedefined);
+        }
+    }
+    if (len >= sizeof(stack)) len= sizeof(stack) -1;
+
+    profiler.samples++;
+    LuaProfCount (stack, (size_t)len);
+}
+
+void LuaProfStart (unsigned count, unsigned periodMs) {
+    profiler.period= (unsigned long)periodMs * 1000;
+    profiler.next= 0;
+    profiler.running= 1;
+    LuaHookRequire (LUA_HOOK_PROFILE, count ? count : LUA_PROF_COUNT);
+}
+
+void LuaProfStop (void) {
+    profiler.running= 0;
+    LuaHookRelease (LUA_HOOK_PROFILE);
+}
+
+void LuaProfReset (void) {
+    for (int idx=0; idx < LUA_PROF_BUCKETS; idx++) {
+        LuaProfEntryT *entry= profiler.table[idx];
+        while (entry) {
+            LuaProfEntryT *next= entry->next;
+            free (entry);
+            entry= next;
+        }
+        profiler.table[idx]= NULL;
+    }
+    profiler.samples= 0;
+}
+
+// write one 'folded-stack count' line per aggregated stack
+int LuaProfDump (FILE *file) {
+    int count=0;
+    for (int idx=0; idx < LUA_PROF_BUCKETS; idx++) {
+        for (LuaProfEntryT *entry= profiler.table[idx]; entry; entry= entry->next) {
+            fprintf (file, "%s %lu\n", entry->stack, entry->count);
+            count++;
+        }
+    }
+    return count;
+}
+
+// folded stacks as one string (caller should free)
+char *LuaProfFolded (void) {
+    char *buffer=NULL;
+    size_t size;
+
+    FILE *file= open_memstream (&buffer, &size);
+    if (!file) return NULL;
+    LuaProfDump (file);
+    fclose (file);
+    return buffer;
+}
+
+// automatic generation of api/profile control verb
+void GlueProfileCb (afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]) {
+    const char *action= "dump";
+    char command[16]= "dump";
+    int count=0, period=0;
+    afb_data_t reply, argD;
+    json_object *replyJ;
+
+    if (nparams > 0 && !afb_data_convert(params[0], &afb_type_predefined_json_c, &argD)) {
+        json_object *argsJ= (json_object*)afb_data_ro_pointer(argD);
+        int err;
+        if (json_object_is_type(argsJ, json_type_string)) {
+            action= json_object_get_string(argsJ);
+            err= 0;
+        } else {
+            err= wrap_json_unpack (argsJ, "{s?s s?i s?i}", "action", &action, "count", &count, "period", &period);
+        }
+        // action string belongs to converted data
+        snprintf (command, sizeof(command), "%s", action);
+        afb_data_unref(argD);
+        if (err) goto OnErrorExit;
+    }
+
+    if (!strcasecmp (command, "start")) {
+        LuaProfStart (count, period);
+        wrap_json_pack (&replyJ, "{ss}", "profiler", "started");
+
+    } else if (!strcasecmp (command, "stop")) {
+        LuaProfStop ();
+        wrap_json_pack (&replyJ, "{ss sI}", "profiler", "stopped", "samples", (int64_t)profiler.samples);
+
+    } else if (!strcasecmp (command, "reset")) {
+        LuaProfReset ();
+        wrap_json_pack (&replyJ, "{ss}", "profiler", "reset");
+
+    } else if (!strcasecmp (command, "dump")) {
+        char *folded= LuaProfFolded();
+        replyJ= json_object_new_string (folded ? folded : "");
+        free (folded);
+
+    } else goto OnErrorExit;
+
+    afb_create_data_raw(&reply, AFB_PREDEFINED_TYPE_JSON_C, replyJ, 0, (void *)json_object_put, replyJ);
+    afb_req_reply(afbRqt, 0, 1, &reply);
+    return;
+
+OnErrorExit:
+    replyJ= json_object_new_string ("syntax: profile {action='start|stop|reset|dump', count=instructions, period=ms}");
+    afb_create_data_raw(&reply, AFB_PREDEFINED_TYPE_JSON_C, replyJ, 0, (void *)json_object_put, replyJ);
+    afb_req_reply(afbRqt, -1, 1, &reply);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <stdio.h>
+#include "lua-afb.h"
+
+#define LUA_PROF_COUNT 10000   // default instructions between samples
+#define LUA_PROF_DEPTH 64      // max sampled frames
+
+void LuaProfStart (unsigned count, unsigned periodMs);
+void LuaProfStop (void);
+void LuaProfReset (void);
+int  LuaProfDump (FILE *file);
+char *LuaProfFolded (void);
+void LuaProfSample (lua_State *luaState, GlueHandleT *glue);
+void GlueProfileCb (afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]);
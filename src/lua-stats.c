@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Per verb counters and latency histograms, exposed through the automatic
+ * api/stats verb and libafb.verbstats.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-stats.h"
+#include "lua-memory.h"
+#include "lua-gc.h"
+#include "lua-log.h"
+#include "lua-bytecode.h"
+#include "lua-capture.h"
+
+static const char *phaseNames[LUA_STAT_PHASES]= {"marshal", "lua", "reply", "total"};
+static const char *marshalNames[LUA_MARSHAL_DIRS]= {"tolua", "fromlua"};
+
+LuaMarshalT luaMarshal[LUA_MARSHAL_DIRS];
+static __thread unsigned marshalDepth;
+
+// monotonic clock in micro-seconds
+unsigned long LuaStatsNow (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000 + (unsigned long)now.tv_nsec / 1000;
+}
+
+static unsigned LuaHistoIndex (unsigned long value) {
+    if (value >> 32) value= 0xFFFFFFFF;
+    if (value < (1 << LUA_HIST_SUBBITS)) return (unsigned)value;
+
+    unsigned msb= 63 - __builtin_clzl(value);
+    unsigned sub= (unsigned)(value >> (msb - LUA_HIST_SUBBITS)) & ((1 << LUA_HIST_SUBBITS) -1);
+    return ((msb - LUA_HIST_SUBBITS +1) << LUA_HIST_SUBBITS) + sub;
+}
+
+// highest value stored within a bucket
+static unsigned long LuaHistoUpper (unsigned index) {
+    if (index < (1 << LUA_HIST_SUBBITS)) return index;
+
+    unsigned msb= (index >> LUA_HIST_SUBBITS) + LUA_HIST_SUBBITS -1;
+    unsigned long sub= index & ((1 << LUA_HIST_SUBBITS) -1);
+    unsigned long width= 1UL << (msb - LUA_HIST_SUBBITS);
+    return (1UL << msb) + (sub+1) * width -1;
+}
+
+void LuaHistoAdd (LuaHistoT *histo, unsigned long value) {
+    histo->buckets[LuaHistoIndex(value)]++;
+    histo->count++;
+    histo->sum += value;
+    if (value > histo->max) histo->max= value;
+}
+
+static unsigned long LuaHistoPercentile (LuaHistoT *histo, unsigned percent) {
+    unsigned long target= (histo->count * percent + 99) / 100, count=0;
+    if (!histo->count) return 0;
+
+    for (unsigned idx=0; idx < LUA_HIST_BUCKETS; idx++) {
+        count += histo->buckets[idx];
+        if (count >= target) {
+            unsigned long upper= LuaHistoUpper(idx);
+            return (upper > histo->max) ? histo->max : upper;
+        }
+    }
+    return histo->max;
+}
+
+json_object *LuaHistoJson (LuaHistoT *histo) {
+    json_object *histoJ;
+    wrap_json_pack (&histoJ, "{sI sI sI sI sI sI}"
+        ,"count", (int64_t)histo->count
+        ,"mean", (int64_t)(histo->count ? histo->sum / histo->count : 0)
+        ,"p50", (int64_t)LuaHistoPercentile(histo, 50)
+        ,"p90", (int64_t)LuaHistoPercentile(histo, 90)
+        ,"p99", (int64_t)LuaHistoPercentile(histo, 99)
+        ,"max", (int64_t)histo->max
+    );
+    return histoJ;
+}
+
+// conversion functions are recursive, only outer call is timed
+unsigned long LuaMarshalEnter (void) {
+    if (marshalDepth++) return 0;
+    return LuaStatsNow();
+}
+
+void LuaMarshalLeave (LuaMarshalDirE dir, unsigned long start) {
+    if (--marshalDepth) return;
+    luaMarshal[dir].calls++;
+    luaMarshal[dir].usec += LuaStatsNow() - start;
+}
+
+// a lua error may longjmp out of a conversion, callbacks start and end with a clean depth
+unsigned LuaMarshalSave (void) {
+    unsigned depth= marshalDepth;
+    marshalDepth= 0;
+    return depth;
+}
+
+void LuaMarshalRestore (unsigned depth) {
+    marshalDepth= depth;
+}
+
+// add counters progress since mark was taken to target
+void LuaMarshalAdd (LuaMarshalT *target, const LuaMarshalT *mark, LuaMarshalDirE dir) {
+    LuaMarshalT *now= &luaMarshal[dir];
+    target->calls  += now->calls  - mark->calls;
+    target->values += now->values - mark->values;
+    target->tables += now->tables - mark->tables;
+    target->bytes  += now->bytes  - mark->bytes;
+    target->usec   += now->usec   - mark->usec;
+}
+
+json_object *LuaMarshalJson (const LuaMarshalT *marshal) {
+    json_object *marshalJ= json_object_new_object();
+
+    for (int idx=0; idx < LUA_MARSHAL_DIRS; idx++) {
+        json_object *dirJ;
+        wrap_json_pack (&dirJ, "{sI sI sI sI sI}"
+            ,"calls", (int64_t)marshal[idx].calls
+            ,"values", (int64_t)marshal[idx].values
+            ,"tables", (int64_t)marshal[idx].tables
+            ,"bytes", (int64_t)marshal[idx].bytes
+            ,"usec", (int64_t)marshal[idx].usec
+        );
+        json_object_object_add (marshalJ, marshalNames[idx], dirJ);
+    }
+    return marshalJ;
+}
+
+// lua verb context is created on verb first call (or when setting its budget)
+LuaVerbCtxT *LuaVerbCtxGet (AfbVcbDataT *vcbData) {
+    if (!vcbData->callback) {
+        json_object *funcJ=json_object_object_get(vcbData->configJ, "callback");
+        if (!funcJ) return NULL;
+
+        LuaVerbCtxT *verbCtx= calloc (1, sizeof(LuaVerbCtxT));
+        verbCtx->callback= json_object_get_string(funcJ);
+        vcbData->callback= (void*)verbCtx;
+    }
+    return (LuaVerbCtxT*)vcbData->callback;
+}
+
+json_object *LuaBudgetJson (LuaBudgetT *budget) {
+    json_object *budgetJ;
+    wrap_json_pack (&budgetJ, "{sI si sI}"
+        ,"instructions", (int64_t)budget->instructions
+        ,"timeout", (int)budget->timeout
+        ,"aborts", (int64_t)budget->aborts
+    );
+    return budgetJ;
+}
+
+// attach verb stats to request handle, reply closes the measure
+void LuaStatsStart (GlueHandleT *glue, LuaVerbStatsT *stats) {
+    assert (glue->magic == GLUE_RQT_MAGIC);
+    glue->rqt.stats= stats;
+    glue->rqt.start= LuaStatsNow();
+    stats->calls++;
+    stats->inflight++;
+}
+
+void LuaStatsDone (GlueHandleT *glue, int status) {
+    LuaVerbStatsT *stats= glue->rqt.stats;
+    if (!stats) return;
+
+    glue->rqt.stats= NULL;
+    stats->inflight--;
+    if (status < 0) stats->errors++;
+    stats->allocs += glue->rqt.allocs;
+    stats->allocBytes += glue->rqt.allocBytes;
+    if (glue->rqt.allocBytes > stats->allocMax) stats->allocMax= glue->rqt.allocBytes;
+    LuaHistoAdd (&stats->histo[LUA_STAT_TOTAL], LuaStatsNow() - glue->rqt.start);
+}
+
+static json_object *LuaVerbStatsJson (const char *verb, LuaVerbStatsT *stats, LuaBudgetT *budget) {
+    json_object *statsJ, *memJ, *latencyJ= json_object_new_object();
+
+    for (int idx=0; idx < LUA_STAT_PHASES; idx++) {
+        json_object_object_add (latencyJ, phaseNames[idx], LuaHistoJson(&stats->histo[idx]));
+    }
+    wrap_json_pack (&memJ, "{sI sI sI}"
+        ,"allocs", (int64_t)stats->allocs
+        ,"bytes", (int64_t)stats->allocBytes
+        ,"max", (int64_t)stats->allocMax
+    );
+    wrap_json_pack (&statsJ, "{ss sI sI sI so so so}"
+        ,"verb", verb
+        ,"calls", (int64_t)stats->calls
+        ,"errors", (int64_t)stats->errors
+        ,"inflight", (int64_t)stats->inflight
+        ,"latency", latencyJ
+        ,"memory", memJ
+        ,"marshal", LuaMarshalJson(stats->marshal)
+    );
+    if (budget) json_object_object_add (statsJ, "budget", LuaBudgetJson(budget));
+    return statsJ;
+}
+
+// walk lua verbs, verbs never called have no stats yet
+json_object *LuaStatsJson (afb_api_t apiv4) {
+    json_object *verbsJ = json_object_new_array();
+    void *glue= afb_api_get_userdata(apiv4);
+    LuaVerbStatsT empty;
+
+    memset (&empty, 0, sizeof(empty));
+    for (int idx = 0; idx < afb_api_v4_verb_count(apiv4); idx++) {
+        const afb_verb_t *afbVerb = afb_api_v4_verb_at(apiv4, idx);
+        if (!afbVerb) break;
+
+        // control verbs (ping, info, stats...) vcbdata is api glue handle, not an AfbVcbDataT
+        if (afbVerb->vcbdata == glue) continue;
+
+        AfbVcbDataT *vcbData= afbVerb->vcbdata;
+        if (!vcbData || vcbData->magic != AfbAddVerbs) continue;
+
+        LuaVerbCtxT *verbCtx= (LuaVerbCtxT*)vcbData->callback;
+        if (verbCtx) json_object_array_add (verbsJ, LuaVerbStatsJson(afbVerb->verb, &verbCtx->stats, &verbCtx->budget));
+        else json_object_array_add (verbsJ, LuaVerbStatsJson(afbVerb->verb, &empty, NULL));
+    }
+    return verbsJ;
+}
+
+// automatic generation of api/stats introspection verb
+void GlueStatsCb (afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]) {
+    afb_api_t apiv4 = afb_req_get_api(afbRqt);
+    afb_data_t reply;
+    json_object *statsJ;
+
+    GlueHandleT *glue = afb_api_get_userdata(apiv4);
+    assert(glue->magic == GLUE_API_MAGIC);
+
+    wrap_json_pack (&statsJ, "{ss so so so so so so so so}"
+        ,"api", afb_api_name(apiv4)
+        ,"memory", LuaMemJson(&glue->api.mem)
+        ,"gc", LuaGcJson(glue->luaState)
+        ,"budget", LuaBudgetJson(&glue->api.budget)
+        ,"marshal", LuaMarshalJson(luaMarshal)
+        ,"log", LuaLogJson()
+        ,"bytecode", LuaBytecodeJson()
+        ,"capture", LuaCaptureJson()
+        ,"verbs", LuaStatsJson(apiv4)
+    );
+    afb_create_data_raw(&reply, AFB_PREDEFINED_TYPE_JSON_C, statsJ, 0, (void *)json_object_put, statsJ);
+    afb_req_reply(afbRqt, 0, 1, &reply);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <json-c/json.h>
+#include "lua-afb.h"
+
+#define LUA_HIST_SUBBITS 2                          // 4 sub-buckets per power of 2
+#define LUA_HIST_BUCKETS (32 << LUA_HIST_SUBBITS)   // up to 2^32 us
+
+// HDR-like log-linear histogram, values in micro-seconds
+typedef struct {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+    unsigned buckets[LUA_HIST_BUCKETS];
+} LuaHistoT;
+
+typedef enum {
+    LUA_STAT_MARSHAL=0, // afb params to lua arguments
+    LUA_STAT_EXEC,      // lua verb code
+    LUA_STAT_REPLY,     // lua returned values to afb reply
+    LUA_STAT_TOTAL,     // verb entry to reply (include async reply)
+    LUA_STAT_PHASES,
+} LuaStatPhaseE;
+
+typedef enum {
+    LUA_MARSHAL_TOLUA=0,    // json/afb-data to lua values
+    LUA_MARSHAL_FROMLUA,    // lua values to json
+    LUA_MARSHAL_DIRS,
+} LuaMarshalDirE;
+
+// conversion counters, time is only measured at outer conversion call
+typedef struct {
+    unsigned long calls;
+    unsigned long values;
+    unsigned long tables;
+    unsigned long bytes;    // string payload
+    unsigned long usec;
+} LuaMarshalT;
+
+extern LuaMarshalT luaMarshal[LUA_MARSHAL_DIRS];
+
+typedef struct LuaVerbStatsS {
+    unsigned long calls;
+    unsigned long errors;
+    long inflight;
+    unsigned long allocs;       // lua allocations done by requests
+    unsigned long allocBytes;
+    unsigned long allocMax;     // biggest request allocation
+    LuaMarshalT marshal[LUA_MARSHAL_DIRS];
+    LuaHistoT histo[LUA_STAT_PHASES];
+} LuaVerbStatsT;
+
+// replace lua function name within afb vcbdata on verb first call
+typedef struct {
+    const char *callback;
+    int bulk;                   // embedded in a verbsadd entry, never lazily created
+    LuaBudgetT budget;
+    LuaVerbStatsT stats;
+} LuaVerbCtxT;
+
+unsigned long LuaStatsNow (void);
+LuaVerbCtxT *LuaVerbCtxGet (AfbVcbDataT *vcbData);
+json_object *LuaBudgetJson (LuaBudgetT *budget);
+void LuaHistoAdd (LuaHistoT *histo, unsigned long value);
+json_object *LuaHistoJson (LuaHistoT *histo);
+void LuaStatsStart (GlueHandleT *glue, LuaVerbStatsT *stats);
+void LuaStatsDone (GlueHandleT *glue, int status);
+json_object *LuaStatsJson (afb_api_t apiv4);
+unsigned long LuaMarshalEnter (void);
+void LuaMarshalLeave (LuaMarshalDirE dir, unsigned long start);
+unsigned LuaMarshalSave (void);
+void LuaMarshalRestore (unsigned depth);
+void LuaMarshalAdd (LuaMarshalT *target, const LuaMarshalT *mark, LuaMarshalDirE dir);
+json_object *LuaMarshalJson (const LuaMarshalT *marshal);
+void GlueStatsCb (afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]);
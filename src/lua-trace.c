@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Request tracing: verb, subcall, timer and event callbacks record spans
+ * with parent/child linkage into a ring buffer. The ring is exported on
+ * demand as Chrome/Perfetto trace-event json. When tracing is off, span
+ * begin/end only test a flag.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-pool.h"
+#include "lua-stats.h"
+#include "lua-trace.h"
+
+typedef struct {
+    unsigned long id;
+    unsigned long parent;
+    unsigned long start;
+    unsigned long duration;
+    unsigned long link;
+    int tid;
+    const char *cat;
+    const char *name;
+} LuaTraceRecT;
+
+static struct {
+    int running;
+    unsigned size;
+    unsigned head;
+    unsigned count;
+    unsigned long lastid;
+    LuaTraceRecT *ring;
+    pthread_mutex_t lock;
+} tracer = {.lock= PTHREAD_MUTEX_INITIALIZER};
+
+static __thread unsigned long currentSpan;
+static __thread int threadId;
+
+// allocate (or resize) and clear span ring, then start recording
+int LuaTraceStart (unsigned size) {
+    if (!size) size= LUA_TRACE_SIZE;
+    if (size > LUA_TRACE_MAX) return -1;
+
+    pthread_mutex_lock (&tracer.lock);
+    if (size != tracer.size) {
+        LuaTraceRecT *ring= calloc (size, sizeof(LuaTraceRecT));
+        if (!ring) goto OnErrorExit;
+        free (tracer.ring);
+        tracer.ring= ring;
+        tracer.size= size;
+    }
+    tracer.head= 0;
+    tracer.count= 0;
+    tracer.running= 1;
+    pthread_mutex_unlock (&tracer.lock);
+    return 0;
+
+OnErrorExit:
+    pthread_mutex_unlock (&tracer.lock);
+    return -1;
+}
+
+void LuaTraceStop (void) {
+    tracer.running= 0;
+}
+
+unsigned long LuaTraceCurrent (void) {
+    return tracer.running ? currentSpan : 0;
+}
+
+// parent=0 use thread current span, names are interned as ring outlives handles
+void LuaTraceBegin (LuaSpanT *span, const char *cat, const char *api, const char *name, unsigned long parent, unsigned long link) {
+    span->id= 0;
+    if (!tracer.running) return;
+
+    pthread_mutex_lock (&tracer.lock);
+    span->id= ++tracer.lastid;
+    pthread_mutex_unlock (&tracer.lock);
+
+    span->cat= cat;
+    span->name= api ? LuaUidIntern (api, name) : NULL;
+    if (!span->name) span->name= LuaStrIntern (name ? name : "unknown");
+    span->parent= parent ? parent : currentSpan;
+    span->previous= currentSpan;
+    span->link= link;
+    span->start= LuaStatsNow();
+    currentSpan= span->id;
+}
+
+void LuaTraceEnd (LuaSpanT *span) {
+    if (!span->id) return;
+    currentSpan= span->previous;
+    if (!threadId) threadId= (int)syscall (SYS_gettid);
+
+    pthread_mutex_lock (&tracer.lock);
+    if (tracer.running) {
+        LuaTraceRecT *rec= &tracer.ring[tracer.head];
+        rec->id= span->id;
+        rec->parent= span->parent;
+        rec->start= span->start;
+        rec->duration= LuaStatsNow() - span->start;
+        rec->link= span->link;
+        rec->tid= threadId;
+        rec->cat= span->cat;
+        rec->name= span->name;
+        tracer.head= (tracer.head +1) % tracer.size;
+        if (tracer.count < tracer.size) tracer.count++;
+    }
+    pthread_mutex_unlock (&tracer.lock);
+}
+
+typedef struct {
+    unsigned long id;
+    int tid;
+} LuaTraceTidT;
+
+static int LuaTraceTidCmp (const void *left, const void *right) {
+    unsigned long leftId= ((const LuaTraceTidT*)left)->id, rightId= ((const LuaTraceTidT*)right)->id;
+    return (leftId > rightId) - (leftId < rightId);
+}
+
+// chrome trace-event format, async children are bound to their parent with flow events
+json_object *LuaTraceJson (void) {
+    json_object *eventsJ= json_object_new_array(), *traceJ;
+    int pid= (int)getpid();
+
+    pthread_mutex_lock (&tracer.lock);
+    unsigned first= tracer.size ? (tracer.head + tracer.size - tracer.count) % tracer.size : 0;
+
+    // flow start is drawn on parent span thread, index recorded spans by id
+    LuaTraceTidT *tids= malloc ((tracer.count ? tracer.count : 1) * sizeof(LuaTraceTidT));
+    if (tids) {
+        for (unsigned idx=0; idx < tracer.count; idx++) {
+            LuaTraceRecT *rec= &tracer.ring[(first + idx) % tracer.size];
+            tids[idx].id= rec->id;
+            tids[idx].tid= rec->tid;
+        }
+        qsort (tids, tracer.count, sizeof(LuaTraceTidT), LuaTraceTidCmp);
+    }
+
+    for (unsigned idx=0; idx < tracer.count; idx++) {
+        LuaTraceRecT *rec= &tracer.ring[(first + idx) % tracer.size];
+        json_object *eventJ;
+
+        wrap_json_pack (&eventJ, "{ss ss ss sI sI si si s{sI sI}}"
+            ,"name", rec->name
+            ,"cat", rec->cat
+            ,"ph", "X"
+            ,"ts", (int64_t)rec->start
+            ,"dur", (int64_t)rec->duration
+            ,"pid", pid
+            ,"tid", rec->tid
+            ,"args", "span", (int64_t)rec->id, "parent", (int64_t)rec->parent
+        );
+        json_object_array_add (eventsJ, eventJ);
+
+        if (rec->link && rec->parent) {
+            LuaTraceTidT key= {.id= rec->parent}, *parent= NULL;
+            if (tids) parent= bsearch (&key, tids, tracer.count, sizeof(LuaTraceTidT), LuaTraceTidCmp);
+
+            // parent span may have left the ring, keep child thread then
+            wrap_json_pack (&eventJ, "{ss ss ss sI sI si si}"
+                ,"name", rec->name, "cat", "flow", "ph", "s"
+                ,"id", (int64_t)rec->id, "ts", (int64_t)rec->link, "pid", pid, "tid", parent ? parent->tid : rec->tid
+            );
+            json_object_array_add (eventsJ, eventJ);
+            wrap_json_pack (&eventJ, "{ss ss ss ss sI sI si si}"
+                ,"name", rec->name, "cat", "flow", "ph", "f", "bp", "e"
+                ,"id", (int64_t)rec->id, "ts", (int64_t)rec->start, "pid", pid, "tid", rec->tid
+            );
+            json_object_array_add (eventsJ, eventJ);
+        }
+    }
+    pthread_mutex_unlock (&tracer.lock);
+    free (tids);
+
+    wrap_json_pack (&traceJ, "{so ss}", "traceEvents", eventsJ, "displayTimeUnit", "ms");
+    return traceJ;
+}
+
+// automatic generation of api/trace control verb
+void GlueTraceCb (afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]) {
+    const char *action= "dump";
+    char command[16]= "dump";
+    int size=0;
+    afb_data_t reply, argD;
+    json_object *replyJ;
+
+    if (nparams > 0 && !afb_data_convert(params[0], &afb_type_predefined_json_c, &argD)) {
+        json_object *argsJ= (json_object*)afb_data_ro_pointer(argD);
+        int err;
+        if (json_object_is_type(argsJ, json_type_string)) {
+            action= json_object_get_string(argsJ);
+            err= 0;
+        } else {
+            err= wrap_json_unpack (argsJ, "{s?s s?i}", "action", &action, "size", &size);
+        }
+        // action string belongs to converted data
+        snprintf (command, sizeof(command), "%s", action);
+        afb_data_unref(argD);
+        if (err || size < 0 || size > LUA_TRACE_MAX) goto OnErrorExit;
+    }
+
+    if (!strcasecmp (command, "start")) {
+        if (LuaTraceStart ((unsigned)size)) goto OnErrorExit;
+        wrap_json_pack (&replyJ, "{ss}", "trace", "started");
+
+    } else if (!strcasecmp (command, "stop")) {
+        LuaTraceStop ();
+        wrap_json_pack (&replyJ, "{ss}", "trace", "stopped");
+
+    } else if (!strcasecmp (command, "dump")) {
+        replyJ= LuaTraceJson();
+
+    } else goto OnErrorExit;
+
+    afb_create_data_raw(&reply, AFB_PREDEFINED_TYPE_JSON_C, replyJ, 0, (void *)json_object_put, replyJ);
+    afb_req_reply(afbRqt, 0, 1, &reply);
+    return;
+
+OnErrorExit:
+    replyJ= json_object_new_string ("syntax: trace {action='start|stop|dump', size=spans(max 65536)}");
+    afb_create_data_raw(&reply, AFB_PREDEFINED_TYPE_JSON_C, replyJ, 0, (void *)json_object_put, replyJ);
+    afb_req_reply(afbRqt, -1, 1, &reply);
+}
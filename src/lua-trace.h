@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <json-c/json.h>
+#include "lua-afb.h"
+
+#define LUA_TRACE_SIZE 4096 // default span ring size
+#define LUA_TRACE_MAX 65536 // max span ring size
+
+// live span, lives on caller stack between begin and end
+typedef struct {
+    unsigned long id;       // 0 when tracing is off
+    unsigned long parent;
+    unsigned long previous; // thread current span to restore on end
+    unsigned long start;
+    unsigned long link;     // async child: time parent issued the call
+    const char *cat;
+    const char *name;
+} LuaSpanT;
+
+int  LuaTraceStart (unsigned size);
+void LuaTraceStop (void);
+void LuaTraceBegin (LuaSpanT *span, const char *cat, const char *api, const char *name, unsigned long parent, unsigned long link);
+void LuaTraceEnd (LuaSpanT *span);
+unsigned long LuaTraceCurrent (void);
+json_object *LuaTraceJson (void);
+void GlueTraceCb (afb_req_t afbRqt, unsigned nparams, afb_data_t const params[]);
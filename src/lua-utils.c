@@ -23,6 +23,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -33,6 +34,10 @@
 #include "glue-afb.h"
 #include "lua-afb.h"
 #include "lua-utils.h"
+#include "lua-stats.h"
+#include "lua-format.h"
+#include "lua-log.h"
+#include "lua-capture.h"
 
 
 
@@ -81,6 +86,18 @@ GlueHandleT *LuaApiPop(lua_State *luaState, int index)
 OnErrorExit:
     return NULL;
 }
+// event handle created by evtnew (evthandler handles have no afb event)
+GlueHandleT *LuaEventPop(lua_State *luaState, int index)
+{
+    GlueHandleT *glue = (GlueHandleT *)lua_touserdata(luaState, index);
+    if (!glue || glue->magic != GLUE_EVT_MAGIC || !glue->event.afb)
+        goto OnErrorExit;
+    return glue;
+
+OnErrorExit:
+    return NULL;
+}
+
 GlueHandleT *LuaLockPop(lua_State *luaState, int index)
 {
     GlueHandleT *luaLock = (GlueHandleT *)lua_touserdata(luaState, index);
@@ -117,6 +134,29 @@ afb_api_t GlueGetApi(GlueHandleT*glue) {
     return afbApi;
 }
 
+// lua api handle owning any glue handle (NULL when not attached to a lua api)
+GlueHandleT *GlueGetApiHandle(GlueHandleT *glue) {
+    afb_api_t apiv4;
+
+    if (!glue) return NULL;
+    switch (glue->magic) {
+        case GLUE_API_MAGIC:
+            return glue;
+        case GLUE_BINDER_MAGIC:
+            return NULL;
+        case GLUE_TIMER_MAGIC:
+            apiv4= glue->timer.apiv4;
+            break;
+        default:
+            apiv4= GlueGetApi(glue);
+    }
+    if (!apiv4) return NULL;
+
+    GlueHandleT *api= afb_api_get_userdata(apiv4);
+    if (!api || api->magic != GLUE_API_MAGIC) return NULL;
+    return api;
+}
+
 GlueHandleT *LuaTimerPop(lua_State *luaState, int index)
 {
     GlueHandleT *glue = (GlueHandleT *)lua_touserdata(luaState, index);
@@ -134,6 +174,10 @@ static void GlueRqtFree(void *userdata)
     GlueHandleT *glue= (GlueHandleT*)userdata;
     assert (glue && glue->magic == GLUE_RQT_MAGIC);
 
+    // request released without lua reply
+    LuaStatsDone (glue, -1);
+    LuaCaptureDone (glue, -1, 0, NULL);
+
     // make sure rqt lua stack is empty, then free it
     lua_settop(glue->luaState,0);
 
@@ -168,6 +212,7 @@ GlueHandleT *GlueRqtNew(afb_req_t afbRqt)
     GlueHandleT *glue = (GlueHandleT *)calloc(1, sizeof(GlueHandleT));
     glue->magic = GLUE_RQT_MAGIC;
     glue->rqt.afb = afbRqt;
+    glue->rqt.api = &api->api;
     glue->luaState = lua_newthread(api->luaState);
 
     // add lua rqt handle to afb request livecycle
@@ -180,8 +225,10 @@ GlueHandleT *GlueRqtNew(afb_req_t afbRqt)
 int GlueReply(GlueHandleT *glue, int status, int nbreply, afb_data_t *reply)
 {
     if (glue->rqt.replied) goto OnErrorExit;
+    LuaCaptureDone (glue, status, nbreply, reply); // reply data is consumed by afb_req_reply
     afb_req_reply(glue->rqt.afb, status, nbreply, reply);
     glue->rqt.replied = 1;
+    LuaStatsDone (glue, status);
     return 0;
 
 OnErrorExit:
@@ -208,7 +255,9 @@ json_object *LuaTableToJson(lua_State *luaState, int index)
     int idx;
     int tableType;
     json_object *tableJ = NULL;
+    unsigned long start= LuaMarshalEnter();
 
+    luaMarshal[LUA_MARSHAL_FROMLUA].tables++;
     lua_pushnil(luaState); // 1st key
     if (index < 0)  index--;
     for (idx = 1; lua_next(luaState, index) != 0; idx++)
@@ -264,16 +313,20 @@ json_object *LuaTableToJson(lua_State *luaState, int index)
         json_object_put(tableJ);
         goto OnErrorExit;
     }
+    LuaMarshalLeave(LUA_MARSHAL_FROMLUA, start);
     return tableJ;
 
 OnErrorExit:
+    LuaMarshalLeave(LUA_MARSHAL_FROMLUA, start);
     return NULL;
 }
 
 json_object *LuaPopOneArg(lua_State *luaState, int idx)
 {
     json_object *valueJ = NULL;
+    unsigned long start= LuaMarshalEnter();
 
+    luaMarshal[LUA_MARSHAL_FROMLUA].values++;
     int luaType = lua_type(luaState, idx);
     switch (luaType)
     {
@@ -288,9 +341,13 @@ json_object *LuaPopOneArg(lua_State *luaState, int idx)
     case LUA_TBOOLEAN:
         valueJ = json_object_new_boolean(lua_toboolean(luaState, idx));
         break;
-    case LUA_TSTRING:
-        valueJ = json_object_new_string(lua_tostring(luaState, idx));
+    case LUA_TSTRING: {
+        size_t length;
+        const char *text= lua_tolstring(luaState, idx, &length);
+        luaMarshal[LUA_MARSHAL_FROMLUA].bytes += length;
+        valueJ = json_object_new_string_len(text, (int)length);
         break;
+    }
     case LUA_TTABLE:
         valueJ = LuaTableToJson(luaState, idx);
         break;
@@ -308,6 +365,7 @@ json_object *LuaPopOneArg(lua_State *luaState, int idx)
         valueJ = NULL;
     }
 
+    LuaMarshalLeave(LUA_MARSHAL_FROMLUA, start);
     return valueJ;
 }
 
@@ -342,12 +400,15 @@ json_object *LuaPopArgs(lua_State *luaState, int start)
 // Push a json structure on the stack as a LUA table
 int LuaPushOneArg(lua_State *luaState,json_object *argsJ)
 {
+    unsigned long start= LuaMarshalEnter();
 
+    luaMarshal[LUA_MARSHAL_TOLUA].values++;
     json_type jtype = json_object_get_type(argsJ);
     switch (jtype)
     {
     case json_type_object:
     {
+        luaMarshal[LUA_MARSHAL_TOLUA].tables++;
         lua_newtable(luaState);
         json_object_object_foreach(argsJ, key, val)
         {
@@ -361,6 +422,7 @@ int LuaPushOneArg(lua_State *luaState,json_object *argsJ)
     case json_type_array:
     {
         int length = (int)json_object_array_length(argsJ);
+        luaMarshal[LUA_MARSHAL_TOLUA].tables++;
         lua_newtable(luaState);
         for (int idx = 0; idx < length; idx++)
         {
@@ -384,7 +446,8 @@ int LuaPushOneArg(lua_State *luaState,json_object *argsJ)
                 break;
             }
         }
-        lua_pushstring(luaState, json_object_get_string(argsJ));
+        luaMarshal[LUA_MARSHAL_TOLUA].bytes += (unsigned long)json_object_get_string_len(argsJ);
+        lua_pushlstring(luaState, text, (size_t)json_object_get_string_len(argsJ));
         break;
         }
     case json_type_boolean:
@@ -401,9 +464,11 @@ int LuaPushOneArg(lua_State *luaState,json_object *argsJ)
         ERROR("LuaPushOneArg: unsupported Json object type %s", json_object_to_json_string(argsJ));
         goto OnErrorExit;
     }
+    LuaMarshalLeave(LUA_MARSHAL_TOLUA, start);
     return 0;
 
 OnErrorExit:
+    LuaMarshalLeave(LUA_MARSHAL_TOLUA, start);
     return -1;
 }
 
@@ -465,8 +530,13 @@ json_object *LuaJsonDbg(lua_State *luaState, const char *message)
 
 int LuaPrintMsg(lua_State *luaState, int level)
 {
-    char *message;
+    char message[LUA_MSG_MAX_LENGTH];
+    LuaFmtArgT args[LUA_FMT_MAX_ARGS];
+    char *dumps[LUA_FMT_MAX_ARGS];
     const char *errorMsg = NULL;
+    const char *format;
+    size_t length;
+    unsigned nargs = 0;
 
     // get binder handle
     GlueHandleT *binder = LuaBinderPop(luaState);
@@ -499,85 +569,63 @@ int LuaPrintMsg(lua_State *luaState, int level)
                 goto OnQuietExit;
     }
 
-    json_object *requestJ = LuaPopArgs(luaState, LUA_FIRST_ARG + 1);
-    if (!requestJ)
+    int argc = lua_gettop(luaState) - LUA_FIRST_ARG;
+    if (argc < 1)
     {
         errorMsg = "LuaPrintMsg empty message";
         goto OnErrorExit;
     }
 
-    // if we have only on argument just return the value.
-    if (json_object_get_type(requestJ) != json_type_array || json_object_array_length(requestJ) < 2)
-    {
-        message = (char *)json_object_get_string(requestJ);
-        goto PrintMessage;
-    }
-
-    // extract format and push all other parameter on the stack
-    message = alloca(LUA_MSG_MAX_LENGTH);
-    const char *format = json_object_get_string(json_object_array_get_idx(requestJ, 0));
-    int arrayIdx = 1;
-    int uidIdx = 0;
-
-    for (int idx = 0; format[idx] != '\0'; idx++)
+    // async mode: capture raw arguments, background thread formats them (errors stay synchronous)
+    if (level != AFB_SYSLOG_LEVEL_ERROR && LuaLogAsync())
     {
-        if (format[idx] == '%' && format[idx + 1] != '\0')
+        int argIdx = LUA_FIRST_ARG + 1;
+        if (argc > 1 && lua_type(luaState, argIdx) == LUA_TSTRING)
         {
-            json_object *slotJ = json_object_array_get_idx(requestJ, arrayIdx);
-            //if (slotJ) GLUE_AFB_NOTICE("**** idx=%d slotJ=%s", arrayIdx, json_object_get_string(slotJ));
-
-            switch (format[++idx])
-            {
-            case 'd':
-                if (slotJ)
-                    uidIdx += snprintf(&message[uidIdx], LUA_MSG_MAX_LENGTH - uidIdx, "%d", json_object_get_int(slotJ));
-                else
-                    uidIdx += snprintf(&message[uidIdx], LUA_MSG_MAX_LENGTH - uidIdx, "nil");
-                arrayIdx++;
-                break;
-            case 'f':
-                if (slotJ)
-                    uidIdx += snprintf(&message[uidIdx], LUA_MSG_MAX_LENGTH - uidIdx, "%f", json_object_get_double(slotJ));
-                else
-                    uidIdx += snprintf(&message[uidIdx], LUA_MSG_MAX_LENGTH - uidIdx, "nil");
-                arrayIdx++;
-                break;
-
-            case '%':
-                message[uidIdx] = '%';
-                uidIdx++;
-                break;
-
-            case 's':
-            default:
-                if (slotJ)
-                    uidIdx += snprintf(&message[uidIdx], LUA_MSG_MAX_LENGTH - uidIdx, "%s", json_object_get_string(slotJ));
-                else
-                    uidIdx += snprintf(&message[uidIdx], LUA_MSG_MAX_LENGTH - uidIdx, "nil");
-                arrayIdx++;
-            }
+            format = lua_tolstring(luaState, argIdx++, &length);
         }
         else
         {
-            if (uidIdx >= LUA_MSG_MAX_LENGTH)
-            {
-                const char *trunc = "... <truncated> ";
-                GLUE_AFB_WARNING(glue, "LuaPrintMsg: message[%s] overflow LUA_MSG_MAX_LENGTH=%d\n", format, LUA_MSG_MAX_LENGTH);
-                uidIdx = LUA_MSG_MAX_LENGTH - 1;
-                memcpy(&message[uidIdx - strlen(trunc)], trunc, strlen(trunc));
-                break;
-            }
-            else
-            {
-                message[uidIdx++] = format[idx];
-            }
+            format = "%s";
+            length = 2;
         }
+        LuaLogPush(luaState, glue, level, __func__, format, length, argIdx, lua_gettop(luaState));
+        return 0;
     }
-    message[uidIdx] = '\0';
 
-PrintMessage:
+    // if we have only one string argument just print it as it is
+    if (argc == 1 && lua_type(luaState, LUA_FIRST_ARG + 1) == LUA_TSTRING)
+    {
+        LuaInfoDbg(luaState, glue, level, __func__, lua_tostring(luaState, LUA_FIRST_ARG + 1));
+        return 0;
+    }
+
+    // format and arguments are read directly from lua stack (no json, no heap)
+    int argIdx = LUA_FIRST_ARG + 1;
+    if (argc > 1 && lua_type(luaState, argIdx) == LUA_TSTRING)
+    {
+        format = lua_tolstring(luaState, argIdx++, &length);
+    }
+    else
+    {
+        format = "%s";
+        length = 2;
+    }
+
+    for (; argIdx <= lua_gettop(luaState) && nargs < LUA_FMT_MAX_ARGS; argIdx++, nargs++)
+    {
+        LuaFmtArg(luaState, argIdx, &args[nargs], &dumps[nargs]);
+    }
+
+    length = LuaFmtFormat(message, sizeof(message), format, length, nargs, args);
+    if (length == sizeof(message) - 1)
+        GLUE_AFB_WARNING(glue, "LuaPrintMsg: message[%s] overflow LUA_MSG_MAX_LENGTH=%d\n", format, LUA_MSG_MAX_LENGTH);
+
     LuaInfoDbg(luaState, glue, level, __func__, message);
-    json_object_put(requestJ);
+    for (unsigned idx = 0; idx < nargs; idx++)
+    {
+        free(dumps[idx]);
+    }
     return 0; // no argument returned to lua
 
 OnErrorExit:
@@ -593,6 +641,8 @@ OnQuietExit:
 // retreive subcall response and build LUA response
 const char *LuaPushAfbReply (lua_State *luaState, unsigned nreplies, const afb_data_t *replies, int *index) {
     const char *errorMsg=NULL;
+    LuaMarshalT *marshal= &luaMarshal[LUA_MARSHAL_TOLUA];
+    unsigned long start= LuaMarshalEnter();
     int count;
 
     *index=0;
@@ -604,13 +654,17 @@ const char *LuaPushAfbReply (lua_State *luaState, unsigned nreplies, const afb_d
                 case Afb_Typeid_Predefined_Stringz: {
                     const char *value= (char*)afb_data_ro_pointer(replies[count]);
                     if (value && value[0]) {
-                        lua_pushstring (luaState, value);
+                        size_t length= strlen(value);
+                        marshal->values++;
+                        marshal->bytes += length;
+                        lua_pushlstring (luaState, value, length);
                         (*index)++;
                     }
                     break;
                 }
                 case Afb_Typeid_Predefined_Bool: {
                     const int *value= (int*)afb_data_ro_pointer(replies[count]);
+                    marshal->values++;
                     lua_pushboolean(luaState, *value);
                     (*index)++;
                     break;
@@ -624,6 +678,7 @@ const char *LuaPushAfbReply (lua_State *luaState, unsigned nreplies, const afb_d
                 case Afb_Typeid_Predefined_I32:
                 case Afb_Typeid_Predefined_U32: {
                     const long *value= (long*)afb_data_ro_pointer(replies[count]);
+                    marshal->values++;
                     lua_pushinteger(luaState, *value);
                     (*index)++;
                     break;
@@ -631,6 +686,7 @@ const char *LuaPushAfbReply (lua_State *luaState, unsigned nreplies, const afb_d
                 case Afb_Typeid_Predefined_Double:
                 case Afb_Typeid_Predefined_Float: {
                     const double *value= (double*)afb_data_ro_pointer(replies[count]);
+                    marshal->values++;
                     lua_pushnumber(luaState, *value);
                     (*index)++;
                     break;
@@ -666,8 +722,93 @@ const char *LuaPushAfbReply (lua_State *luaState, unsigned nreplies, const afb_d
             }
         }
     }
+    LuaMarshalLeave(LUA_MARSHAL_TOLUA, start);
     return NULL;
 
 OnErrorExit:
+    LuaMarshalLeave(LUA_MARSHAL_TOLUA, start);
     return errorMsg;
-}
\ No newline at end of file
+}
+// afb data wrapped as lua userdata, payload is only decoded when requested
+typedef struct {
+    afb_data_t afb;
+} LuaDataT;
+
+afb_data_t LuaDataPop (lua_State *luaState, int index)
+{
+    LuaDataT *data= (LuaDataT*) luaL_testudata(luaState, index, LUA_DATA_META);
+    if (!data) return NULL;
+    return data->afb;
+}
+
+static int LuaDataDecode (lua_State *luaState)
+{
+    int count;
+    LuaDataT *data= (LuaDataT*) luaL_checkudata(luaState, LUA_FIRST_ARG, LUA_DATA_META);
+
+    const char *errorMsg= LuaPushAfbReply (luaState, 1, &data->afb, &count);
+    if (errorMsg) {
+        lua_pushstring(luaState, errorMsg);
+        lua_error(luaState);
+    }
+    if (!count) lua_pushnil(luaState);
+    return 1;
+}
+
+static int LuaDataGc (lua_State *luaState)
+{
+    LuaDataT *data= (LuaDataT*) luaL_checkudata(luaState, LUA_FIRST_ARG, LUA_DATA_META);
+    if (data->afb) afb_data_unref (data->afb);
+    data->afb= NULL;
+    return 0;
+}
+
+static const luaL_Reg LuaDataMethods[] = {
+    {"decode", LuaDataDecode},
+    {NULL, NULL}
+};
+
+void LuaDataRegister (lua_State *luaState)
+{
+    if (luaL_newmetatable(luaState, LUA_DATA_META)) {
+        luaL_newlib(luaState, LuaDataMethods);
+        lua_setfield(luaState, -2, "__index");
+        lua_pushcfunction(luaState, LuaDataGc);
+        lua_setfield(luaState, -2, "__gc");
+    }
+    lua_pop(luaState, 1);
+}
+
+// push each data as an 'afb-data' userdata holding one reference
+int LuaPushAfbData (lua_State *luaState, unsigned nparams, const afb_data_t *params)
+{
+    int count=0;
+
+    luaL_checkstack(luaState, (int)nparams, "LuaPushAfbData");
+    for (int idx=0; idx < nparams; idx++) {
+        if (!params[idx]) continue;
+        LuaDataT *data= (LuaDataT*) lua_newuserdata(luaState, sizeof(LuaDataT));
+        data->afb= afb_data_addref(params[idx]);
+        luaL_setmetatable(luaState, LUA_DATA_META);
+        count++;
+    }
+    return count;
+}
+
+// convert one lua argument to afb data, 'afb-data' userdata are shared without re-encoding
+int LuaPopOneData (lua_State *luaState, int index, afb_data_t *data)
+{
+    afb_data_t afb= LuaDataPop(luaState, index);
+    if (afb) {
+        *data= afb_data_addref(afb);
+        return 0;
+    }
+
+    json_object *valueJ= LuaPopOneArg(luaState, index);
+    if (!valueJ) goto OnErrorExit;
+    afb_create_data_raw(data, AFB_PREDEFINED_TYPE_JSON_C, valueJ, 0, (void *)json_object_put, valueJ);
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
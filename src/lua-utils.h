@@ -38,6 +38,7 @@ int LuaPrintMsg(lua_State *luaState, int level);
 json_object *LuaJsonDbg (lua_State *luaState, const char *message);
 
 afb_api_t GlueGetApi(GlueHandleT*glue);
+GlueHandleT *GlueGetApiHandle(GlueHandleT *glue);
 GlueHandleT *GlueRqtNew(afb_req_t afbRqt);
 void GlueRqtAddref(GlueHandleT *glue);
 void GlueRqtUnref(GlueHandleT *glue);
@@ -55,3 +56,9 @@ json_object *LuaPopArgs(lua_State *luaState, int start);
 json_object *LuaPopOneArg(lua_State *luaState,  int idx);
 int LuaPushOneArg(lua_State *luaState, json_object *argsJ);
 const char *LuaPushAfbReply (lua_State *luaState, unsigned replies, const afb_data_t *reply, int *index);
+
+#define LUA_DATA_META "afb-data"
+void LuaDataRegister (lua_State *luaState);
+int LuaPushAfbData (lua_State *luaState, unsigned nparams, const afb_data_t *params);
+afb_data_t LuaDataPop (lua_State *luaState, int index);
+int LuaPopOneData (lua_State *luaState, int index, afb_data_t *data);
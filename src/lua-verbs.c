@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Bulk verb registration: a whole lua verb array is read straight from lua
+ * (no json-c conversion) and registered in one pass. Verb control blocks and
+ * their strings are allocated as two blocks sized upfront, lua callbacks are
+ * resolved at registration. Verb json metadata (api/info, config) is only
+ * built when someone asks for it. Verbs using other keys than
+ * uid/verb/callback/info (auth, sample, ...) still go through libglue.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <wrap-json.h>
+
+#include "lua-afb.h"
+#include "lua-utils.h"
+#include "lua-callbacks.h"
+#include "lua-stats.h"
+#include "lua-pool.h"
+#include "lua-verbs.h"
+
+typedef struct {
+    AfbVcbDataT vcbData;   // must stay first, afb vcbdata points here
+    LuaVerbCtxT verbCtx;   // set at registration, never lazily
+    const char *uid;
+    const char *verb;
+    const char *info;
+} LuaVerbEntryT;
+
+static pthread_mutex_t verbsLock= PTHREAD_MUTEX_INITIALIZER;
+
+// keep lua strings (anchored by verbs table) and count arena bytes, return 0 when verb needs libglue
+static int LuaVerbsParse (lua_State *luaState, int index, LuaVerbEntryT *entry, size_t *bytes) {
+    int simple= 1;
+
+    lua_pushnil(luaState);
+    while (lua_next(luaState, index)) {
+        const char *key= (lua_type(luaState, -2) == LUA_TSTRING) ? lua_tostring(luaState, -2) : NULL;
+        const char *value= (lua_type(luaState, -1) == LUA_TSTRING) ? lua_tostring(luaState, -1) : NULL;
+        lua_pop(luaState, 1);
+
+        if (!key || !value) simple= 0;
+        else if (!strcmp(key, "uid")) entry->uid= value;
+        else if (!strcmp(key, "verb")) entry->verb= value;
+        else if (!strcmp(key, "callback")) entry->verbCtx.callback= value;
+        else if (!strcmp(key, "info")) entry->info= value;
+        else simple= 0;
+    }
+    if (!entry->verb || !entry->verbCtx.callback) simple= 0;
+
+    if (simple) {
+        *bytes += strlen(entry->verb) +1;
+        if (entry->uid) *bytes += strlen(entry->uid) +1;
+        if (entry->info) *bytes += strlen(entry->info) +1;
+    }
+    return simple;
+}
+
+static const char *LuaVerbsCopy (char **cursor, const char *text) {
+    char *copy= *cursor;
+    if (!text) return NULL;
+
+    size_t len= strlen(text) +1;
+    memcpy (copy, text, len);
+    *cursor += len;
+    return copy;
+}
+
+// register verbs array at index, verbs added before an error stay registered
+const char *LuaVerbsAdd (lua_State *luaState, GlueHandleT *binder, GlueHandleT *glue, int index) {
+    const char *errorMsg= "verbsadd: verbs should be an array of {verb=, callback=, [uid=], [info=]}";
+    LuaVerbEntryT *entries= NULL;
+    unsigned char *simple= NULL;
+    char *arena= NULL;
+    int registered= 0;
+    size_t bytes= 0;
+
+    index= lua_absindex(luaState, index);
+    if (!lua_istable(luaState, index)) goto OnErrorExit;
+
+    lua_Integer count= luaL_len(luaState, index);
+    if (count <= 0) return NULL;
+
+    // pass 1: size everything upfront
+    entries= calloc ((size_t)count, sizeof(LuaVerbEntryT));
+    simple= calloc ((size_t)count, 1);
+    if (!entries || !simple) goto OnErrorExit;
+
+    for (lua_Integer idx=0; idx < count; idx++) {
+        lua_rawgeti(luaState, index, idx+1);
+        if (!lua_istable(luaState, -1)) {
+            lua_pop(luaState, 1);
+            goto OnErrorExit;
+        }
+        simple[idx]= (unsigned char) LuaVerbsParse (luaState, lua_gettop(luaState), &entries[idx], &bytes);
+        lua_pop(luaState, 1);
+    }
+
+    arena= malloc (bytes ? bytes : 1);
+    if (!arena) goto OnErrorExit;
+
+    // pass 2: register
+    char *cursor= arena;
+    for (lua_Integer idx=0; idx < count; idx++) {
+        LuaVerbEntryT *entry= &entries[idx];
+
+        if (!simple[idx]) {
+            lua_rawgeti(luaState, index, idx+1);
+            json_object *verbJ= LuaPopOneArg(luaState, lua_gettop(luaState));
+            lua_pop(luaState, 1);
+            if (!verbJ) goto OnErrorExit;
+
+            errorMsg= AfbAddOneVerb (binder->binder.afb, glue->api.afb, verbJ, GlueApiVerbCb, NULL);
+            if (errorMsg) goto OnErrorExit;
+            continue;
+        }
+
+        entry->verb= LuaVerbsCopy (&cursor, entry->verb);
+        entry->uid= entry->uid ? LuaVerbsCopy (&cursor, entry->uid) : entry->verb;
+        entry->info= LuaVerbsCopy (&cursor, entry->info);
+        entry->verbCtx.callback= LuaStrIntern (entry->verbCtx.callback);
+        entry->verbCtx.bulk= 1;
+        entry->vcbData.magic= (void*)AfbAddVerbs;
+        entry->vcbData.callback= (void*)&entry->verbCtx;
+
+        registered= 1;
+        int err= afb_api_add_verb(glue->api.afb, entry->verb, entry->info, GlueApiVerbCb, &entry->vcbData, NULL, 0, 0);
+        if (err) {
+            errorMsg= "verbsadd: fail to register verb (duplicated name?)";
+            goto OnErrorExit;
+        }
+    }
+    free (simple);
+    return NULL;
+
+OnErrorExit:
+    free (simple);
+    if (!registered) {
+        free (entries);
+        free (arena);
+    }
+    return errorMsg;
+}
+
+// bulk verbs have no configJ until first requested
+json_object *LuaVerbsMeta (AfbVcbDataT *vcbData) {
+    pthread_mutex_lock (&verbsLock);
+
+    // libglue verbs have a smaller vcbData, only bulk entries may be cast
+    LuaVerbCtxT *verbCtx= (LuaVerbCtxT*)vcbData->callback;
+    if (!vcbData->configJ && verbCtx && verbCtx->bulk) {
+        LuaVerbEntryT *entry= (LuaVerbEntryT*)vcbData;
+        wrap_json_pack (&vcbData->configJ, "{ss ss ss ss*}"
+            ,"uid", entry->uid
+            ,"verb", entry->verb
+            ,"callback", entry->verbCtx.callback
+            ,"info", entry->info
+        );
+    }
+    pthread_mutex_unlock (&verbsLock);
+    return vcbData->configJ;
+}
+
+// metadata of every lua verb (bulk and libglue ones), control verbs excluded
+json_object *LuaVerbsJson (afb_api_t apiv4) {
+    json_object *verbsJ= json_object_new_array();
+    void *glue= afb_api_get_userdata(apiv4);
+
+    for (int idx = 0; idx < afb_api_v4_verb_count(apiv4); idx++) {
+        const afb_verb_t *afbVerb = afb_api_v4_verb_at(apiv4, idx);
+        if (!afbVerb) break;
+        if (afbVerb->vcbdata == glue) continue;
+
+        AfbVcbDataT *vcbData= afbVerb->vcbdata;
+        if (!vcbData || vcbData->magic != AfbAddVerbs) continue;
+
+        json_object *verbJ= LuaVerbsMeta (vcbData);
+        if (verbJ) json_object_array_add (verbsJ, json_object_get(verbJ));
+    }
+    return verbsJ;
+}
+
+// api config as given by user, verbs included (caller should put returned object)
+json_object *LuaVerbsConfig (afb_api_t apiv4, json_object *configJ) {
+    json_object *fullJ= json_object_new_object();
+
+    json_object_object_foreach (configJ, key, valueJ) {
+        json_object_object_add (fullJ, key, json_object_get(valueJ));
+    }
+    json_object_object_add (fullJ, "verbs", LuaVerbsJson(apiv4));
+    return fullJ;
+}
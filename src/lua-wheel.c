@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ *
+ * Hashed timer wheel: every wheel timer shares one afb timer ticking every
+ * LUA_WHEEL_TICK_MS. Nodes are hashed on their expiration tick, insert/cancel
+ * are O(1) and never touch the kernel.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "lua-afb.h"
+#include "lua-wheel.h"
+
+#define LUA_WHEEL_MASK (LUA_WHEEL_SLOTS-1)
+
+typedef struct {
+    LuaWheelNodeT slots[LUA_WHEEL_SLOTS]; // sentinel list heads
+    unsigned long tick;   // last processed tick
+    unsigned armed;       // number of linked nodes
+    afb_timer_t afb;      // shared afb timer, only running when armed
+    lua_State *luaState;  // shared interpretor for wheel lua callbacks
+} LuaWheelT;
+
+static LuaWheelT wheel;
+
+// current wheel tick from monotonic clock (only used when ticking)
+static unsigned long LuaWheelClock (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((unsigned long)now.tv_sec * 1000 + (unsigned long)now.tv_nsec / 1000000) / LUA_WHEEL_TICK_MS;
+}
+
+static void LuaWheelLink (LuaWheelNodeT *node) {
+    LuaWheelNodeT *head= &wheel.slots[node->expire & LUA_WHEEL_MASK];
+    node->next= head;
+    node->prev= head->prev;
+    head->prev->next= node;
+    head->prev= node;
+    wheel.armed++;
+}
+
+static void LuaWheelUnlink (LuaWheelNodeT *node) {
+    if (!node->next) return;
+    node->prev->next= node->next;
+    node->next->prev= node->prev;
+    node->next= node->prev= NULL;
+    wheel.armed--;
+}
+
+// process one slot, nodes not yet expired (other wheel rounds) are relinked
+static void LuaWheelRunSlot (unsigned slot, unsigned long now) {
+    LuaWheelNodeT *head= &wheel.slots[slot];
+    LuaWheelNodeT pending;
+
+    if (head->next == head) return;
+
+    // move slot list to a private list, callbacks may arm/disarm any node
+    pending.next= head->next;
+    pending.prev= head->prev;
+    pending.next->prev= &pending;
+    pending.prev->next= &pending;
+    head->next= head->prev= head;
+
+    while (pending.next != &pending) {
+        LuaWheelNodeT *node= pending.next;
+        LuaWheelUnlink (node);
+
+        if (node->expire > now) {
+            LuaWheelLink (node);
+            continue;
+        }
+
+        // rearm before callback as lua may reset or free the node
+        unsigned decount= node->count;
+        if (node->count != 1) {
+            if (node->count) node->count--;
+            node->expire= now + node->period;
+            LuaWheelLink (node);
+        } else {
+            node->count= 0;
+        }
+        node->callback (node, decount);
+    }
+}
+
+static void LuaWheelTickCb (afb_timer_x4_t timer, void *userdata, int decount) {
+    unsigned long now= LuaWheelClock();
+
+    if (now - wheel.tick > LUA_WHEEL_SLOTS) {
+        // lagging more than one wheel round, scan every slot once
+        wheel.tick= now;
+        for (unsigned slot=0; slot < LUA_WHEEL_SLOTS; slot++) LuaWheelRunSlot (slot, now);
+    } else {
+        while (wheel.tick < now) {
+            wheel.tick++;
+            LuaWheelRunSlot ((unsigned)(wheel.tick & LUA_WHEEL_MASK), wheel.tick);
+        }
+    }
+
+    // nothing left to watch, release afb timer until next arm
+    if (!wheel.armed && wheel.afb) {
+        afb_timer_unref (wheel.afb);
+        wheel.afb= NULL;
+    }
+}
+
+static int LuaWheelStart (void) {
+    int err;
+
+    if (wheel.afb) return 0;
+
+    if (!wheel.slots[0].next) {
+        for (int idx=0; idx < LUA_WHEEL_SLOTS; idx++) {
+            wheel.slots[idx].next= wheel.slots[idx].prev= &wheel.slots[idx];
+        }
+    }
+
+    wheel.tick= LuaWheelClock();
+    err= afb_timer_create (&wheel.afb, 0, 0, 0, 0, LUA_WHEEL_TICK_MS, 0, LuaWheelTickCb, NULL, 0);
+    if (err) {
+        wheel.afb= NULL;
+        goto OnErrorExit;
+    }
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
+
+// arm (or rearm) a node, rearming an armed node is a simple relink
+int LuaWheelArm (LuaWheelNodeT *node, unsigned periodMs, unsigned count) {
+    assert (node->callback);
+
+    int err= LuaWheelStart();
+    if (err) goto OnErrorExit;
+
+    LuaWheelUnlink (node);
+    node->period= (periodMs + LUA_WHEEL_TICK_MS -1) / LUA_WHEEL_TICK_MS;
+    if (!node->period) node->period= 1;
+    node->count= count;
+    node->expire= wheel.tick + node->period;
+    LuaWheelLink (node);
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
+
+void LuaWheelDisarm (LuaWheelNodeT *node) {
+    LuaWheelUnlink (node);
+}
+
+int LuaWheelIsArmed (LuaWheelNodeT *node) {
+    return (node->next != NULL);
+}
+
+// wheel lua timers share one interpretor thread instead of one per timer
+lua_State *LuaWheelThread (lua_State *luaState) {
+    if (!wheel.luaState) {
+        wheel.luaState= lua_newthread(luaState);
+        luaL_ref(luaState, LUA_REGISTRYINDEX); // pop thread and keep it away from garbage collector
+    }
+    return wheel.luaState;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ * Author: Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+#pragma once
+
+#include <lua.h>
+
+#define LUA_WHEEL_TICK_MS 10  // wheel resolution in ms
+#define LUA_WHEEL_SLOTS 512   // number of hashed slots (power of 2)
+
+typedef struct LuaWheelNodeS LuaWheelNodeT;
+typedef void (*LuaWheelCbT) (LuaWheelNodeT *node, unsigned decount);
+
+// wheel node is embedded within its owner handle (no allocation)
+struct LuaWheelNodeS {
+    LuaWheelNodeT *next;
+    LuaWheelNodeT *prev;
+    unsigned long expire; // absolute wheel tick
+    unsigned period;      // in wheel tick
+    unsigned count;       // remaining run (0=infinite)
+    LuaWheelCbT callback;
+    void *context;
+};
+
+int  LuaWheelArm (LuaWheelNodeT *node, unsigned periodMs, unsigned count);
+void LuaWheelDisarm (LuaWheelNodeT *node);
+int  LuaWheelIsArmed (LuaWheelNodeT *node);
+lua_State *LuaWheelThread (lua_State *luaState);